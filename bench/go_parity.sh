@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compares cpp::channel with Go channels on the Go runtime's benchmarks
+#
+# Builds bench/src/cpp/chan_bench.cpp and runs it next to the Go
+# benchmarks of the same names in bench/src/go/chanbench, then prints
+# the nanoseconds per operation of both. Arguments are passed on to the
+# C++ benchmarks, e.g. --filter=ChanProdCons or --repetitions=10.
+#
+# Environment: CXX (default g++), CXXFLAGS (default -O2), GO (default go)
+# and GO_BENCHTIME (default 1s).
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+GO=${GO:-go}
+GO_BENCHTIME=${GO_BENCHTIME:-1s}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+echo "building C++ benchmarks" >&2
+$CXX $CXXFLAGS -std=c++11 -pthread -I include \
+  bench/src/cpp/chan_bench.cpp src/*.cpp -o "$tmp/chan_bench"
+
+echo "running C++ benchmarks" >&2
+"$tmp/chan_bench" "$@" | tail -n +2 | awk '{ print $1, $2 }' > "$tmp/cpp.txt"
+
+echo "running Go benchmarks" >&2
+$GO test -run '^$' -bench . -benchtime "$GO_BENCHTIME" \
+  bench/src/go/chanbench/chan_test.go |
+  awk '/^Benchmark/ { name = $1; sub(/^Benchmark/, "", name);
+         sub(/-[0-9]+$/, "", name); print name, $3 }' > "$tmp/go.txt"
+
+awk 'NR == FNR { go[$1] = $2; next }
+     BEGIN { printf "%-20s %14s %14s %10s\n", "benchmark", "Go ns/op",
+               "C++ ns/op", "C++/Go" }
+     {
+       if ($1 in go)
+         printf "%-20s %14.1f %14.1f %10.2f\n", $1, go[$1], $2,
+           (go[$1] > 0 ? $2 / go[$1] : 0)
+     }' "$tmp/go.txt" "$tmp/cpp.txt"
@@ -0,0 +1,348 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_BENCH_H
+#define CPP_CHANNEL_BENCH_H
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "perf.h"
+
+/// Minimal benchmark harness for the programs in bench/src/cpp
+
+/// Every benchmark is a function that performs state::ops operations.
+/// It is called a number of times for warmup, and then repeatedly
+/// timed. The results are summarized as a table on std::cout and, if
+/// requested, as JSON that can be tracked over time:
+///
+///     int main(int argc, char* argv[])
+///     {
+///       bench::suite suite(argc, argv);
+///       suite.run("create", 100000, [](bench::state& s)
+///       {
+///         for (std::size_t i = 0; i < s.ops; i++)
+///           bench::do_not_optimize(cpp::channel<int>());
+///       });
+///       return suite.finish();
+///     }
+///
+/// A benchmark can report further measurements, such as context
+/// switches, in state::counters.
+///
+/// Command line flags: --warmup=W, --repetitions=R, --filter=S (only
+/// run benchmarks whose name contains S), --json=PATH and --perf, which
+/// adds the hardware performance counters of every benchmark, divided
+/// by its number of operations, to its counters (see perf_counters).
+namespace bench
+{
+
+/// Keeps the compiler from optimizing away the computation of t
+template<class T>
+void do_not_optimize(const T& t)
+{
+  asm volatile("" : : "r"(&t) : "memory");
+}
+
+typedef std::chrono::steady_clock clock;
+
+/// If arg is "flag=value", stores value and returns true
+inline bool parse_flag(const std::string& arg, const char* flag,
+  std::string& value)
+{
+  const std::string prefix(std::string(flag) + "=");
+  if (arg.compare(0, prefix.size(), prefix) != 0)
+    return false;
+
+  value = arg.substr(prefix.size());
+  return true;
+}
+
+/// Is name one of the arguments?
+inline bool has_flag(int argc, char* argv[], const char* name)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (name == std::string(argv[i]))
+      return true;
+  }
+  return false;
+}
+
+/// Value of the last "name=N" argument, or n if there is none
+inline unsigned long flag(int argc, char* argv[], const char* name,
+  unsigned long n)
+{
+  std::string value;
+  for (int i = 1; i < argc; i++)
+  {
+    if (parse_flag(argv[i], name, value))
+      n = std::stoul(value);
+  }
+  return n;
+}
+
+/// Passed to every repetition of a benchmark
+class state
+{
+private:
+  clock::time_point m_start;
+  perf_counters* m_perf;
+
+public:
+  /// Number of operations to perform
+  const std::size_t ops;
+
+  /// Further measurements by name, averaged over all repetitions
+  std::map<std::string, double> counters;
+
+  explicit state(std::size_t n, perf_counters* perf = nullptr)
+  : m_start(clock::now()),
+    m_perf(perf),
+    ops(n),
+    counters() {}
+
+  /// Restarts the clock and counters, so that setup is not measured
+  void start()
+  {
+    if (m_perf)
+      m_perf->reset();
+
+    m_start = clock::now();
+  }
+
+  clock::time_point started() const
+  {
+    return m_start;
+  }
+};
+
+/// Summary of the nanoseconds per operation over all repetitions
+struct summary
+{
+  double min;
+  double median;
+  double mean;
+  double stddev;
+  double max;
+
+  explicit summary(std::vector<double> samples)
+  : min(0), median(0), mean(0), stddev(0), max(0)
+  {
+    if (samples.empty())
+      return;
+
+    std::sort(samples.begin(), samples.end());
+    const std::size_t n = samples.size();
+    min = samples.front();
+    max = samples.back();
+    median = n % 2 ? samples[n / 2] :
+      (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+    for (double sample : samples)
+      mean += sample;
+    mean /= n;
+
+    for (double sample : samples)
+      stddev += (sample - mean) * (sample - mean);
+    stddev = n > 1 ? std::sqrt(stddev / (n - 1)) : 0;
+  }
+};
+
+struct result
+{
+  std::string name;
+  std::size_t ops;
+  std::size_t repetitions;
+  summary ns_per_op;
+  std::map<std::string, double> counters;
+
+  double ops_per_second() const
+  {
+    return ns_per_op.median > 0 ? 1e9 / ns_per_op.median : 0;
+  }
+};
+
+class suite
+{
+private:
+  unsigned m_warmup;
+  unsigned m_repetitions;
+  std::string m_filter;
+  std::string m_json;
+  bool m_perf;
+  std::vector<result> m_results;
+
+  static void write_json_summary(std::ostream& out, const summary& s)
+  {
+    out << "{\"min\":" << s.min << ",\"median\":" << s.median <<
+      ",\"mean\":" << s.mean << ",\"stddev\":" << s.stddev <<
+      ",\"max\":" << s.max << '}';
+  }
+
+public:
+  /// Reads the flags described above, and ignores all other arguments
+  suite(int argc, char* argv[])
+  : m_warmup(1),
+    m_repetitions(5),
+    m_filter(),
+    m_json(),
+    m_perf(false),
+    m_results()
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      const std::string arg(argv[i]);
+      std::string value;
+      if (parse_flag(arg, "--warmup", value))
+        m_warmup = std::stoul(value);
+      else if (parse_flag(arg, "--repetitions", value))
+        m_repetitions = std::max(1ul, std::stoul(value));
+      else if (parse_flag(arg, "--filter", value))
+        m_filter = value;
+      else if (parse_flag(arg, "--json", value))
+        m_json = value;
+    }
+    m_perf = has_flag(argc, argv, "--perf");
+
+    if (m_perf)
+    {
+      const perf_counters perf;
+      if (!perf.error().empty())
+        std::cerr << "some perf counters are unavailable (" <<
+          perf.error() << ')' << std::endl;
+    }
+
+    std::cout << std::left << std::setw(32) << "benchmark" << std::right <<
+      std::setw(12) << "ns/op" << std::setw(10) << "stddev" <<
+      std::setw(14) << "ops/s" << std::endl;
+  }
+
+  /// Times f unless it is filtered out
+
+  /// Propagates exceptions thrown by f
+  void run(const std::string& name, std::size_t ops,
+    const std::function<void(state&)>& f)
+  {
+    if (name.find(m_filter) == std::string::npos)
+      return;
+
+    for (unsigned i = 0; i < m_warmup; i++)
+    {
+      state s(ops);
+      f(s);
+    }
+
+    std::vector<double> samples;
+    std::map<std::string, double> counters;
+    for (unsigned i = 0; i < m_repetitions; i++)
+    {
+      // opened per repetition to count the threads that f creates
+      std::unique_ptr<perf_counters> perf;
+      if (m_perf)
+      {
+        perf.reset(new perf_counters());
+        perf->enable();
+      }
+
+      state s(ops, perf.get());
+      f(s);
+      const std::chrono::duration<double, std::nano> elapsed =
+        clock::now() - s.started();
+      samples.push_back(elapsed.count() / (ops ? ops : 1));
+
+      if (perf)
+      {
+        perf->disable();
+        for (const std::pair<const std::string, double>& value : perf->read())
+          s.counters[value.first + "_per_op"] = value.second / (ops ? ops : 1);
+      }
+
+      for (const std::pair<const std::string, double>& counter : s.counters)
+        counters[counter.first] += counter.second / m_repetitions;
+    }
+
+    m_results.push_back(result{name, ops, m_repetitions, summary(samples),
+      counters});
+    const result& r = m_results.back();
+    std::cout << std::left << std::setw(32) << name << std::right <<
+      std::fixed << std::setprecision(1) << std::setw(12) <<
+      r.ns_per_op.median << ' ' << std::setw(9) << r.ns_per_op.stddev <<
+      ' ' << std::setprecision(0) << std::setw(13) << r.ops_per_second();
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(4);
+    for (const std::pair<const std::string, double>& counter : r.counters)
+      std::cout << "  " << counter.first << '=' << counter.second;
+    std::cout << std::endl;
+  }
+
+  const std::vector<result>& results() const
+  {
+    return m_results;
+  }
+
+  void write_json(std::ostream& out) const
+  {
+    out << "{\"context\":{\"hardware_concurrency\":" <<
+      std::thread::hardware_concurrency() << ",\"warmup\":" << m_warmup <<
+      ",\"repetitions\":" << m_repetitions << "},\"benchmarks\":[";
+
+    const char* separator = "";
+    for (const result& r : m_results)
+    {
+      out << separator << "{\"name\":\"" << r.name << "\",\"ops\":" <<
+        r.ops << ",\"repetitions\":" << r.repetitions <<
+        ",\"ns_per_op\":";
+      write_json_summary(out, r.ns_per_op);
+      out << ",\"ops_per_second\":" << r.ops_per_second();
+      if (!r.counters.empty())
+      {
+        const char* counter_separator = "";
+        out << ",\"counters\":{";
+        for (const std::pair<const std::string, double>& counter : r.counters)
+        {
+          out << counter_separator << '"' << counter.first << "\":" <<
+            counter.second;
+          counter_separator = ",";
+        }
+        out << '}';
+      }
+      out << '}';
+      separator = ",";
+    }
+    out << "]}\n";
+  }
+
+  /// Writes the JSON file, if any, and returns the exit status
+  int finish() const
+  {
+    if (m_json.empty())
+      return EXIT_SUCCESS;
+
+    std::ofstream out(m_json);
+    write_json(out);
+    out.close();
+    if (!out)
+    {
+      std::cerr << "cannot write " << m_json << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include <channel>
+#include <atomic>
+#include <vector>
+
+#include "bench.h"
+
+// C++ ports of the channel benchmarks of the Go runtime
+//
+// Every benchmark has the same name and structure as its counterpart in
+// bench/src/go/chanbench/chan_test.go, so that bench/go_parity.sh can
+// compare the nanoseconds per operation of both. Goroutines become
+// threads, and GOMAXPROCS becomes std::thread::hardware_concurrency().
+//
+// \see https://go.dev/src/runtime/chan_test.go
+
+static unsigned procs()
+{
+  const unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Like Go's b.RunParallel: procs() threads share the s.ops iterations
+template<class Function>
+void run_parallel(bench::state& s, Function f)
+{
+  const unsigned n = procs();
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < n; p++)
+    threads.emplace_back(f, s.ops / n + (p < s.ops % n));
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+void ChanNonblocking(bench::state& s)
+{
+  cpp::channel<int> myc;
+  run_parallel(s, [myc](std::size_t ops)
+  {
+    cpp::select select;
+    select.recv(myc, [](int) {});
+    for (std::size_t i = 0; i < ops; i++)
+      select.try_once();
+  });
+}
+
+void SelectUncontended(bench::state& s)
+{
+  run_parallel(s, [](std::size_t ops)
+  {
+    cpp::channel<int, 1> myc1, myc2;
+    myc1.send(0);
+
+    cpp::select select;
+    select.recv(myc1, [&myc2](int) { myc2.send(0); });
+    select.recv(myc2, [&myc1](int) { myc1.send(0); });
+    for (std::size_t i = 0; i < ops; i++)
+      select.wait();
+  });
+}
+
+// Go sizes both channels to GOMAXPROCS; here, capacity is a template
+// argument, so it is large enough for up to 256 threads.
+void SelectContended(bench::state& s)
+{
+  cpp::channel<int, 256> myc1, myc2;
+  run_parallel(s, [myc1, myc2](std::size_t ops) mutable
+  {
+    myc1.send(0);
+
+    cpp::select select;
+    select.recv(myc1, [&myc2](int) { myc2.send(0); });
+    select.recv(myc2, [&myc1](int) { myc1.send(0); });
+    for (std::size_t i = 0; i < ops; i++)
+      select.wait();
+  });
+}
+
+constexpr int calls_per_sched = 1000;
+
+template<std::size_t N>
+void ChanProdCons(bench::state& s)
+{
+  const unsigned n = procs();
+  std::atomic<int> batches(s.ops / calls_per_sched);
+  cpp::channel<int, N> myc;
+  std::vector<std::thread> threads;
+
+  for (unsigned p = 0; p < n; p++)
+  {
+    threads.emplace_back([myc, &batches]() mutable
+    {
+      while (batches.fetch_sub(1) > 0)
+      {
+        for (int g = 0; g < calls_per_sched; g++)
+          myc.send(1);
+      }
+      myc.send(0);
+    });
+    threads.emplace_back([myc]() mutable
+    {
+      while (myc.recv() != 0) {}
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+void ChanSync(bench::state& s)
+{
+  constexpr unsigned n = 2;
+  std::atomic<int> batches(s.ops / calls_per_sched / n * n);
+  cpp::channel<int> myc;
+  std::vector<std::thread> threads;
+
+  for (unsigned p = 0; p < n; p++)
+  {
+    threads.emplace_back([myc, &batches]() mutable
+    {
+      for (;;)
+      {
+        const int i = batches.fetch_sub(1) - 1;
+        if (i < 0)
+          break;
+
+        for (int g = 0; g < calls_per_sched; g++)
+        {
+          if (i % 2 == 0)
+          {
+            myc.recv();
+            myc.send(0);
+          }
+          else
+          {
+            myc.send(0);
+            myc.recv();
+          }
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// Since every receiver is a thread rather than a goroutine, both ports
+// have 100 instead of the Go runtime's 1000 receivers. Like Go's select,
+// select_any() sleeps while both of its channels are empty.
+void ChanPopular(bench::state& s)
+{
+  constexpr unsigned n = 100;
+  cpp::channel<bool> c;
+  std::vector<cpp::channel<bool>> a(n);
+  std::vector<std::thread> threads;
+
+  for (cpp::channel<bool>& d : a)
+  {
+    threads.emplace_back([c, d](std::size_t ops)
+    {
+      const std::vector<cpp::channel<bool>> channels{c, d};
+      bool b;
+      for (std::size_t i = 0; i < ops; i++)
+        cpp::select_any(channels, b);
+    }, s.ops);
+  }
+
+  for (std::size_t i = 0; i < s.ops; i++)
+  {
+    for (cpp::channel<bool>& d : a)
+      d.send(true);
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+void ChanCreation(bench::state& s)
+{
+  run_parallel(s, [](std::size_t ops)
+  {
+    for (std::size_t i = 0; i < ops; i++)
+    {
+      cpp::channel<int, 1> myc;
+      myc.send(0);
+      myc.recv();
+    }
+  });
+}
+
+int main(int argc, char* argv[])
+{
+  bench::suite suite(argc, argv);
+
+  suite.run("ChanNonblocking", 1000000, ChanNonblocking);
+  suite.run("SelectUncontended", 200000, SelectUncontended);
+  suite.run("SelectContended", 200000, SelectContended);
+  suite.run("ChanProdCons0", 20000, ChanProdCons<0>);
+  suite.run("ChanProdCons10", 100000, ChanProdCons<10>);
+  suite.run("ChanProdCons100", 100000, ChanProdCons<100>);
+  suite.run("ChanSync", 20000, ChanSync);
+  suite.run("ChanPopular", 5, ChanPopular);
+  suite.run("ChanCreation", 200000, ChanCreation);
+
+  return suite.finish();
+}
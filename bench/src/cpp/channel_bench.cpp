@@ -0,0 +1,237 @@
+#include <channel>
+#include <channel_adaptive.h>
+#include <channel_parallel.h>
+#include <channel_pipeline.h>
+#include <channel_shard.h>
+#include <vector>
+
+#include "bench.h"
+
+// Round trips of an element between two threads
+template<std::size_t N>
+void pingpong(bench::state& s)
+{
+  cpp::channel<std::size_t, N> ping, pong;
+  std::thread echo([ping, pong](std::size_t ops) mutable
+  {
+    for (std::size_t i = 0; i < ops; i++)
+      pong.send(ping.recv());
+  }, s.ops);
+  cpp::thread_guard echo_guard(echo);
+
+  s.start();
+  for (std::size_t i = 0; i < s.ops; i++)
+  {
+    ping.send(i);
+    pong.recv();
+  }
+}
+
+// Producers send s.ops elements in total, consumers receive them
+template<class Channel>
+void throughput(bench::state& s, unsigned producers, unsigned consumers)
+{
+  Channel c;
+  std::vector<std::thread> threads;
+
+  s.start();
+  for (unsigned p = 0; p < producers; p++)
+  {
+    const std::size_t n = s.ops / producers + (p < s.ops % producers);
+    threads.emplace_back([c](std::size_t ops) mutable
+    {
+      for (std::size_t i = 0; i < ops; i++)
+        c.send(i);
+    }, n);
+  }
+  for (unsigned k = 0; k < consumers; k++)
+  {
+    const std::size_t n = s.ops / consumers + (k < s.ops % consumers);
+    threads.emplace_back([c](std::size_t ops) mutable
+    {
+      for (std::size_t i = 0; i < ops; i++)
+        bench::do_not_optimize(c.recv());
+    }, n);
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// One shard submits s.ops tasks to another one, like throughput/spsc
+void shard_throughput(bench::state& s)
+{
+  cpp::shard_runtime runtime(2);
+  cpp::channel<std::size_t, 1> done;
+
+  // owned by shard 1
+  std::size_t count = 0;
+
+  s.start();
+  runtime.submit_to(0, [&runtime, &count, &s, done]
+  {
+    for (std::size_t i = 0; i < s.ops; i++)
+      runtime.submit_to(1, [&count] { count++; });
+
+    runtime.submit_to(1, [&count, done]() mutable { done.send(count); });
+  });
+  bench::do_not_optimize(done.recv());
+}
+
+// A source, a map, a filter and a sink of s.ops elements; with costs,
+// the builder fuses all of them into one loop
+void pipeline(bench::state& s, bool has_costs)
+{
+  const cpp::stage_hint hint(cpp::cost(has_costs ? 1 : -1));
+  std::size_t next = 0, sum = 0;
+  cpp::pipeline p(cpp::make_pipeline<std::size_t>("source",
+      [&next, &s](std::size_t& i) -> bool
+      {
+        i = next++;
+        return i < s.ops;
+      }, hint)
+    .map("map", [](std::size_t i) { return 3 * i; }, hint)
+    .filter("filter", [](std::size_t i) { return i % 2 == 0; }, hint)
+    .to("sink", [&sum](std::size_t i) { sum += i; }, hint));
+
+  s.start();
+  p.run();
+  bench::do_not_optimize(sum);
+}
+
+// One producer, and workers that sum up s.ops elements, either with
+// parallel_reduce() or by sending every result to another channel
+void reduce(bench::state& s, unsigned workers, bool has_result_channel)
+{
+  cpp::channel<std::size_t, 64> c;
+  std::thread producer([c](std::size_t ops) mutable
+  {
+    for (std::size_t i = 0; i < ops; i++)
+      c.send(i);
+  }, s.ops);
+  cpp::thread_guard producer_guard(producer);
+
+  s.start();
+  if (!has_result_channel)
+  {
+    bench::do_not_optimize(cpp::parallel_reduce(c, s.ops, std::size_t(0),
+      [](std::size_t a, std::size_t b) { return a + b; }, workers));
+    return;
+  }
+
+  cpp::channel<std::size_t, 64> results;
+  std::vector<std::thread> threads;
+  for (unsigned k = 0; k < workers; k++)
+  {
+    const std::size_t n = s.ops / workers + (k < s.ops % workers);
+    threads.emplace_back([c, results](std::size_t ops) mutable
+    {
+      for (std::size_t i = 0; i < ops; i++)
+        results.send(c.recv());
+    }, n);
+  }
+
+  std::size_t sum = 0;
+  for (std::size_t i = 0; i < s.ops; i++)
+    sum += results.recv();
+  bench::do_not_optimize(sum);
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// Select over k ready cases, one of which has an element
+void select_cases(bench::state& s, std::size_t k)
+{
+  std::vector<cpp::channel<std::size_t, 1>> channels(k);
+  std::size_t sum = 0;
+  cpp::select select;
+  for (cpp::channel<std::size_t, 1>& c : channels)
+    select.recv(c, [&sum](std::size_t i) { sum += i; });
+
+  s.start();
+  for (std::size_t i = 0; i < s.ops; i++)
+  {
+    channels[i % k].send(i);
+    if (!select.try_once())
+      std::abort();
+  }
+  bench::do_not_optimize(sum);
+}
+
+// Same as select_cases(), but with select_any() instead of a select
+void select_any_cases(bench::state& s, std::size_t k)
+{
+  std::vector<cpp::channel<std::size_t, 1>> channels(k);
+  std::size_t sum = 0, t = 0;
+
+  s.start();
+  for (std::size_t i = 0; i < s.ops; i++)
+  {
+    channels[i % k].send(i);
+    if (cpp::try_select_any(channels, t) == k)
+      std::abort();
+    sum += t;
+  }
+  bench::do_not_optimize(sum);
+}
+
+template<std::size_t N>
+void create_destroy(bench::state& s)
+{
+  for (std::size_t i = 0; i < s.ops; i++)
+  {
+    cpp::channel<std::size_t, N> c;
+    bench::do_not_optimize(c);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  bench::suite suite(argc, argv);
+
+  suite.run("pingpong/unbuffered", 20000, pingpong<0>);
+  suite.run("pingpong/buffered", 20000, pingpong<1>);
+
+  typedef cpp::channel<std::size_t, 64> buffered;
+  typedef cpp::adaptive_channel<std::size_t, 64> adaptive;
+  suite.run("throughput/spsc", 200000,
+    [](bench::state& s) { throughput<buffered>(s, 1, 1); });
+  suite.run("throughput/mpsc", 200000,
+    [](bench::state& s) { throughput<buffered>(s, 4, 1); });
+  suite.run("throughput/mpmc", 200000,
+    [](bench::state& s) { throughput<buffered>(s, 4, 4); });
+  suite.run("throughput/spsc/unbuffered", 20000,
+    [](bench::state& s) { throughput<cpp::channel<std::size_t>>(s, 1, 1); });
+  suite.run("throughput/spsc/adaptive", 200000,
+    [](bench::state& s) { throughput<adaptive>(s, 1, 1); });
+  suite.run("throughput/mpsc/adaptive", 200000,
+    [](bench::state& s) { throughput<adaptive>(s, 4, 1); });
+  suite.run("throughput/spsc/shard", 200000, shard_throughput);
+
+  suite.run("reduce/4", 200000,
+    [](bench::state& s) { reduce(s, 4, false); });
+  suite.run("reduce/4/result_channel", 200000,
+    [](bench::state& s) { reduce(s, 4, true); });
+
+  suite.run("pipeline/fused", 200000,
+    [](bench::state& s) { pipeline(s, true); });
+  suite.run("pipeline/unfused", 200000,
+    [](bench::state& s) { pipeline(s, false); });
+
+  for (std::size_t k : {1, 2, 4, 8, 16})
+  {
+    suite.run("select/" + std::to_string(k), 100000,
+      [k](bench::state& s) { select_cases(s, k); });
+  }
+  for (std::size_t k : {1, 2, 4, 8, 16})
+  {
+    suite.run("select_any/" + std::to_string(k), 100000,
+      [k](bench::state& s) { select_any_cases(s, k); });
+  }
+
+  suite.run("create_destroy/unbuffered", 100000, create_destroy<0>);
+  suite.run("create_destroy/buffered", 100000, create_destroy<64>);
+
+  return suite.finish();
+}
@@ -0,0 +1,185 @@
+#include <channel>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <sys/resource.h>
+
+#include "bench.h"
+
+// Dining philosophers at scale
+//
+// Usage: dining [--philosophers=P] [--duration-ms=D] [--perf]
+//
+// Like ChannelTest.DiningPhilosophersDeadlockFree, every fork and every
+// philosopher is a thread, and a philosopher picks up and puts down a
+// fork by sending to the fork's unbuffered channels. Unlike the test,
+// philosophers keep eating for D (default 1000) milliseconds. For 5, 50,
+// ..., up to P (default 1000) philosophers, a line of CSV is written to
+// std::cout with
+//
+// - meals_per_second: meals of all philosophers per second
+// - min_meals, max_meals: fairness between the philosophers
+// - fairness: Jain's index of the meals, from 1/P (one philosopher ate)
+//   to 1 (all ate equally often)
+// - voluntary_switches_per_meal: context switches because a thread
+//   blocked, which measures the contention of the channels
+// - involuntary_switches_per_meal: preemptions
+// - with --perf, cycles, instructions, cache misses and branch misses
+//   per meal; empty if a counter is unavailable
+
+static const char* const perf_columns[] = {"cycles", "instructions",
+  "cache_misses", "branch_misses"};
+
+// Sent to a fork instead of a philosopher's number to end its thread
+constexpr std::size_t quit = std::numeric_limits<std::size_t>::max();
+
+struct dining_table
+{
+  std::vector<cpp::channel<std::size_t>> picksup;
+  std::vector<cpp::channel<std::size_t>> putsdown;
+  std::atomic<bool> is_closed;
+
+  explicit dining_table(std::size_t n)
+  : picksup(n),
+    putsdown(n),
+    is_closed(false) {}
+};
+
+void phil_fork(std::size_t i, dining_table& t)
+{
+  while (t.picksup[i].recv() != quit)
+    t.putsdown[i].recv();
+}
+
+// Philosopher 0 picks up the right fork first, all others the left one.
+// Meals are counted locally, so that philosophers whose counters share
+// a cache line do not slow each other down.
+void phil_person(std::size_t i, dining_table& t, std::uint64_t& meals)
+{
+  const std::size_t n = t.picksup.size();
+  const std::size_t first = i == 0 ? (i + 1) % n : i;
+  const std::size_t second = i == 0 ? i : (i + 1) % n;
+
+  std::uint64_t eaten = 0;
+  while (!t.is_closed.load(std::memory_order_relaxed))
+  {
+    t.picksup[first].send(i);
+    t.picksup[second].send(i);
+    eaten++;
+    t.putsdown[second].send(i);
+    t.putsdown[first].send(i);
+  }
+  meals = eaten;
+}
+
+static void rusage_switches(long& voluntary, long& involuntary)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    voluntary = involuntary = 0;
+    return;
+  }
+
+  voluntary = usage.ru_nvcsw;
+  involuntary = usage.ru_nivcsw;
+}
+
+void dine(std::size_t n, std::chrono::milliseconds duration, bool has_perf)
+{
+  dining_table t(n);
+  std::vector<std::uint64_t> meals(n, 0);
+  std::vector<std::thread> forks, philosophers;
+
+  std::unique_ptr<bench::perf_counters> perf;
+  if (has_perf)
+  {
+    perf.reset(new bench::perf_counters());
+    perf->enable();
+  }
+
+  long voluntary_start, involuntary_start;
+  rusage_switches(voluntary_start, involuntary_start);
+  const bench::clock::time_point start = bench::clock::now();
+
+  for (std::size_t i = 0; i < n; i++)
+    forks.emplace_back(phil_fork, i, std::ref(t));
+  for (std::size_t i = 0; i < n; i++)
+    philosophers.emplace_back(phil_person, i, std::ref(t), std::ref(meals[i]));
+
+  std::this_thread::sleep_for(duration);
+  t.is_closed.store(true);
+  for (std::thread& thread : philosophers)
+    thread.join();
+
+  const std::chrono::duration<double> seconds = bench::clock::now() - start;
+  long voluntary, involuntary;
+  rusage_switches(voluntary, involuntary);
+
+  std::map<std::string, double> counts;
+  if (perf)
+  {
+    perf->disable();
+    counts = perf->read();
+  }
+
+  // every fork is on the table again
+  for (cpp::channel<std::size_t>& c : t.picksup)
+    c.send(quit);
+  for (std::thread& thread : forks)
+    thread.join();
+
+  double total = 0, squares = 0;
+  for (std::uint64_t m : meals)
+  {
+    total += m;
+    squares += static_cast<double>(m) * m;
+  }
+  const double per_meal = total > 0 ? 1 / total : 0;
+
+  std::cout << n << ',' << total << ',' << total / seconds.count() << ',' <<
+    *std::min_element(meals.begin(), meals.end()) << ',' <<
+    *std::max_element(meals.begin(), meals.end()) << ',' <<
+    (squares > 0 ? total * total / (n * squares) : 0) << ',' <<
+    (voluntary - voluntary_start) * per_meal << ',' <<
+    (involuntary - involuntary_start) * per_meal;
+
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+    {
+      std::cout << ',';
+      if (counts.count(column))
+        std::cout << counts[column] * per_meal;
+    }
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t max_philosophers =
+    std::max(2ul, bench::flag(argc, argv, "--philosophers", 1000));
+  const std::chrono::milliseconds duration(
+    bench::flag(argc, argv, "--duration-ms", 1000));
+  const bool has_perf = bench::has_flag(argc, argv, "--perf");
+
+  std::cout << "philosophers,meals,meals_per_second,min_meals,max_meals," <<
+    "fairness,voluntary_switches_per_meal,involuntary_switches_per_meal";
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+      std::cout << ',' << column << "_per_meal";
+  }
+  std::cout << std::endl;
+
+  for (std::size_t n = 5; n < max_philosophers; n *= 10)
+    dine(n, duration, has_perf);
+  dine(max_philosophers, duration, has_perf);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+#include <channel>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "bench.h"
+
+// Memory footprint of cpp::channel
+//
+// Usage: footprint [--channels=C] [--elements=E] [bench::suite flags]
+//
+// For every element type in {char, std::size_t, 64 bytes, std::string}
+// and every capacity N in {0, 1, 64, 1024}, two benchmarks are run:
+//
+// - idle/<type>/<N> constructs C (default 100000) channels and reports
+//   the bytes per channel
+// - queued/<type>/<N> (only for N > 0) fills channels with N elements
+//   each, E (default 100000) elements in total, and reports the bytes
+//   per queued element, excluding the idle channels themselves
+//
+// Bytes are reported as counters both as allocated by malloc, which
+// is exact but glibc only, and as the growth of the resident set size,
+// which includes the allocator's own overhead and fragmentation. The
+// time per operation is the time to construct a channel or to enqueue
+// an element, respectively. With --json=PATH, the counters are written
+// along with the times, so that footprint regressions can be tracked.
+
+template<std::size_t S>
+struct bytes
+{
+  std::array<char, S> data;
+};
+
+// Bytes allocated by malloc and not yet freed, or 0 if unknown
+static double heap_bytes()
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+  return static_cast<unsigned>(mallinfo().uordblks);
+#else
+  return 0;
+#endif
+}
+
+// Resident set size in bytes, or 0 if unknown
+static double rss_bytes()
+{
+  std::FILE* statm = std::fopen("/proc/self/statm", "r");
+  if (statm == nullptr)
+    return 0;
+
+  unsigned long size = 0, resident = 0;
+  const int n = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+  return n == 2 ? static_cast<double>(resident) * sysconf(_SC_PAGESIZE) : 0;
+}
+
+// Returns freed memory to the operating system, so that the resident
+// set size grows with every allocation of a benchmark
+static void trim()
+{
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
+template<class T>
+T make_element()
+{
+  return T();
+}
+
+template<>
+std::string make_element()
+{
+  // too long for the small string optimization
+  return std::string(32, 'x');
+}
+
+template<class T, std::size_t N>
+void idle(bench::state& s)
+{
+  std::vector<cpp::channel<T, N>> channels;
+  channels.reserve(s.ops);
+
+  // a large reservation is only mapped, so fill it once to make its
+  // pages resident before the baseline
+  channels.resize(s.ops);
+  channels.clear();
+
+  trim();
+  const double heap = heap_bytes();
+  const double rss = rss_bytes();
+
+  s.start();
+  for (std::size_t i = 0; i < s.ops; i++)
+    channels.emplace_back();
+
+  // the handles in the vector were allocated before the baseline
+  s.counters["heap_bytes_per_channel"] = (heap_bytes() - heap) / s.ops +
+    sizeof(cpp::channel<T, N>);
+  s.counters["rss_bytes_per_channel"] = (rss_bytes() - rss) / s.ops +
+    sizeof(cpp::channel<T, N>);
+}
+
+template<class T, std::size_t N>
+void queued(bench::state& s)
+{
+  static_assert(N > 0, "only buffered channels can hold elements");
+
+  std::vector<cpp::channel<T, N>> channels((s.ops + N - 1) / N);
+  const T element(make_element<T>());
+
+  trim();
+  const double heap = heap_bytes();
+  const double rss = rss_bytes();
+
+  // a send to a channel with fewer than N elements does not block
+  s.start();
+  for (std::size_t i = 0; i < s.ops; i++)
+    channels[i / N].send(element);
+
+  s.counters["heap_bytes_per_element"] = (heap_bytes() - heap) / s.ops;
+  s.counters["rss_bytes_per_element"] = (rss_bytes() - rss) / s.ops;
+}
+
+template<class T, std::size_t N>
+struct capacity
+{
+  static void run(bench::suite& suite, const std::string& type,
+    std::size_t channels, std::size_t elements)
+  {
+    const std::string name(type + '/' + std::to_string(N));
+    suite.run("idle/" + name, channels, idle<T, N>);
+    suite.run("queued/" + name, elements, queued<T, N>);
+  }
+};
+
+template<class T>
+struct capacity<T, 0>
+{
+  static void run(bench::suite& suite, const std::string& type,
+    std::size_t channels, std::size_t)
+  {
+    suite.run("idle/" + type + "/0", channels, idle<T, 0>);
+  }
+};
+
+template<class T>
+void element_type(bench::suite& suite, const std::string& type,
+  std::size_t channels, std::size_t elements)
+{
+  capacity<T, 0>::run(suite, type, channels, elements);
+  capacity<T, 1>::run(suite, type, channels, elements);
+  capacity<T, 64>::run(suite, type, channels, elements);
+  capacity<T, 1024>::run(suite, type, channels, elements);
+}
+
+int main(int argc, char* argv[])
+{
+  bench::suite suite(argc, argv);
+  const std::size_t channels =
+    std::max(1ul, bench::flag(argc, argv, "--channels", 100000));
+  const std::size_t elements =
+    std::max(1ul, bench::flag(argc, argv, "--elements", 100000));
+
+  element_type<char>(suite, "char", channels, elements);
+  element_type<std::size_t>(suite, "size_t", channels, elements);
+  element_type<bytes<64>>(suite, "bytes64", channels, elements);
+  element_type<std::string>(suite, "string", channels, elements);
+  return suite.finish();
+}
@@ -0,0 +1,111 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_HISTOGRAM_H
+#define CPP_CHANNEL_HISTOGRAM_H
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace bench
+{
+
+/// Histogram of nonnegative integers in the style of HdrHistogram
+
+/// Values below 256 are counted exactly. Larger values fall into one
+/// of 128 equally wide buckets per power of two, so that a percentile
+/// is reported with a relative error below 1%. Recording is a constant
+/// number of integer operations and never allocates, so it can be done
+/// on the measured path.
+///
+/// \see http://hdrhistogram.org
+class histogram
+{
+private:
+  static constexpr unsigned exact_bits = 8;
+  static constexpr std::uint64_t exact = 1u << exact_bits;
+  static constexpr std::uint64_t half = exact / 2;
+
+  std::vector<std::uint64_t> m_counts;
+  std::uint64_t m_total;
+  std::uint64_t m_max;
+
+  static std::size_t index(std::uint64_t v)
+  {
+    if (v < exact)
+      return v;
+
+    const unsigned msb = 63 - __builtin_clzll(v);
+    const unsigned shift = msb - exact_bits + 1;
+    return exact + (shift - 1) * half + ((v >> shift) - half);
+  }
+
+  // Largest value that falls into the same bucket as index i
+  static std::uint64_t highest(std::size_t i)
+  {
+    if (i < exact)
+      return i;
+
+    const unsigned shift = (i - exact) / half + 1;
+    const std::uint64_t sub = (i - exact) % half + half;
+    return ((sub + 1) << shift) - 1;
+  }
+
+public:
+  histogram()
+  : m_counts(index(~std::uint64_t(0)) + 1, 0),
+    m_total(0),
+    m_max(0) {}
+
+  void record(std::uint64_t v)
+  {
+    m_counts[index(v)]++;
+    m_total++;
+    m_max = std::max(m_max, v);
+  }
+
+  void merge(const histogram& other)
+  {
+    for (std::size_t i = 0; i < m_counts.size(); i++)
+      m_counts[i] += other.m_counts[i];
+
+    m_total += other.m_total;
+    m_max = std::max(m_max, other.m_max);
+  }
+
+  std::uint64_t count() const
+  {
+    return m_total;
+  }
+
+  std::uint64_t max() const
+  {
+    return m_max;
+  }
+
+  /// Smallest recorded value v such that the fraction q of all values
+  /// are less than or equal to v, within the histogram's precision
+  std::uint64_t percentile(double q) const
+  {
+    if (m_total == 0)
+      return 0;
+
+    const std::uint64_t rank = std::max<std::uint64_t>(1,
+      static_cast<std::uint64_t>(std::ceil(q * m_total)));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < m_counts.size(); i++)
+    {
+      seen += m_counts[i];
+      if (seen >= rank)
+        return std::min(highest(i), m_max);
+    }
+    return m_max;
+  }
+};
+
+}
+
+#endif
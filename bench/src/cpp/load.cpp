@@ -0,0 +1,160 @@
+#include <channel>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+#include "bench.h"
+#include "histogram.h"
+
+// Open-loop load generator for cpp::channel
+//
+// Usage: load [--min-rate=R] [--max-rate=R] [--steps=S] [--duration-ms=D]
+//             [--poisson=0|1] [--seed=X]
+//
+// A closed-loop benchmark sends its next message only after the previous
+// one has been sent, so a stalled channel simply causes fewer messages
+// and the stall hardly shows in the latencies ("coordinated omission").
+// Here, a generator follows a schedule of intended send times instead,
+// with either fixed intervals or exponentially distributed ones (a
+// Poisson process). If a send is late, the following sends happen as
+// soon as possible, and the latency of every message is measured from
+// its intended send time to the end of its receive.
+//
+// For every channel capacity in {0, 1, 64}, the offered load grows in S
+// (default 12) geometric steps from min-rate (default 1000) to max-rate
+// (default 2000000) messages per second, and each load is offered for D
+// (default 200) milliseconds. Every load is written as a line of CSV to
+// std::cout, with the achieved rate and the latency percentiles in
+// nanoseconds; plotted over the offered rate, these are the percentile
+// curves of the channel. The knee of each curve, the first load whose
+// p99 latency is ten times that of the lowest load or that is not
+// sustained, is reported on std::cerr.
+
+// Marks the end of a schedule
+constexpr std::int64_t end_of_schedule = -1;
+
+static std::int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    bench::clock::now().time_since_epoch()).count();
+}
+
+struct load_result
+{
+  double offered_rate;
+  double achieved_rate;
+  bench::histogram latency;
+};
+
+// Sends intended send times according to the schedule, and records the
+// latency of every one of them at the receiver
+template<std::size_t N>
+load_result offer(double rate, std::chrono::milliseconds duration,
+  bool is_poisson, std::mt19937_64& random)
+{
+  cpp::channel<std::int64_t, N> c;
+  load_result result = {rate, 0, bench::histogram()};
+
+  std::thread receiver([c, &result]() mutable
+  {
+    for (std::int64_t intended = c.recv(); intended != end_of_schedule;
+         intended = c.recv())
+      result.latency.record(std::max<std::int64_t>(0, now_ns() - intended));
+  });
+  cpp::thread_guard receiver_guard(receiver);
+
+  std::exponential_distribution<double> exponential(rate);
+  const std::int64_t start = now_ns();
+  const std::int64_t end = start +
+    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+  std::int64_t intended = start;
+  std::uint64_t sent = 0;
+  while (intended < end)
+  {
+    const std::int64_t now = now_ns();
+    if (intended > now)
+      std::this_thread::sleep_for(std::chrono::nanoseconds(intended - now));
+
+    c.send(intended);
+    sent++;
+
+    const double interval = is_poisson ? exponential(random) : 1 / rate;
+    intended += static_cast<std::int64_t>(interval * 1e9);
+  }
+
+  // the rate includes the time to catch up with the schedule
+  const double seconds = (now_ns() - start) * 1e-9;
+  c.send(end_of_schedule);
+
+  // a buffered send returns before the receiver has drained the queue
+  receiver.join();
+  result.achieved_rate = sent / seconds;
+  return result;
+}
+
+template<std::size_t N>
+void sweep(const std::vector<double>& rates,
+  std::chrono::milliseconds duration, bool is_poisson, std::uint64_t seed)
+{
+  std::mt19937_64 random(seed);
+  double baseline_p99 = 0;
+  bool has_knee = false;
+
+  for (double rate : rates)
+  {
+    const load_result r = offer<N>(rate, duration, is_poisson, random);
+    const bench::histogram& h = r.latency;
+
+    std::cout << N << ',' << (is_poisson ? "poisson" : "fixed") << ',' <<
+      r.offered_rate << ',' << r.achieved_rate << ',' << h.count() << ',' <<
+      h.percentile(0.5) << ',' << h.percentile(0.9) << ',' <<
+      h.percentile(0.99) << ',' << h.percentile(0.999) << ',' <<
+      h.percentile(0.9999) << ',' << h.max() << std::endl;
+
+    const double p99 = h.percentile(0.99);
+    if (baseline_p99 == 0)
+      baseline_p99 = p99;
+
+    if (!has_knee &&
+        (p99 > 10 * baseline_p99 || r.achieved_rate < 0.9 * r.offered_rate))
+    {
+      std::cerr << "capacity " << N << ": knee at " << rate <<
+        " messages per second" << std::endl;
+      has_knee = true;
+    }
+  }
+
+  if (!has_knee)
+    std::cerr << "capacity " << N << ": no knee up to " << rates.back() <<
+      " messages per second" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  const double min_rate = bench::flag(argc, argv, "--min-rate", 1000);
+  const double max_rate =
+    std::max<double>(min_rate, bench::flag(argc, argv, "--max-rate", 2000000));
+  const unsigned steps = std::max(1ul, bench::flag(argc, argv, "--steps", 12));
+  const std::chrono::milliseconds duration(
+    bench::flag(argc, argv, "--duration-ms", 200));
+  const bool is_poisson = bench::flag(argc, argv, "--poisson", 0) != 0;
+  const std::uint64_t seed = bench::flag(argc, argv, "--seed", 1);
+
+  std::vector<double> rates;
+  for (unsigned i = 0; i < steps; i++)
+  {
+    rates.push_back(steps == 1 ? min_rate :
+      min_rate * std::pow(max_rate / min_rate, double(i) / (steps - 1)));
+  }
+
+  std::cout << "capacity,arrival,offered_rate,achieved_rate,messages," <<
+    "p50_ns,p90_ns,p99_ns,p999_ns,p9999_ns,max_ns" << std::endl;
+
+  sweep<0>(rates, duration, is_poisson, seed);
+  sweep<1>(rates, duration, is_poisson, seed);
+  sweep<64>(rates, duration, is_poisson, seed);
+  return EXIT_SUCCESS;
+}
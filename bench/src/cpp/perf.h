@@ -0,0 +1,166 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_PERF_H
+#define CPP_CHANNEL_PERF_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace bench
+{
+
+/// Hardware and software performance counters of the calling process
+
+/// Counts cycles, instructions, cache misses, branch misses and context
+/// switches of the calling thread and of all threads that it creates
+/// while the counters exist. Threads created earlier are not counted.
+///
+/// Counters that the kernel does not provide, for example in containers
+/// or if /proc/sys/kernel/perf_event_paranoid forbids them, are left
+/// out; if none is available, read() returns an empty map. Counters
+/// that had to share the hardware with others are scaled to the time
+/// that they were enabled.
+///
+/// \see perf_event_open(2)
+class perf_counters
+{
+private:
+  struct counter
+  {
+    const char* name;
+    int fd;
+  };
+
+  std::vector<counter> m_counters;
+  std::string m_error;
+
+#ifdef __linux__
+  void open(const char* name, std::uint32_t type, std::uint64_t config)
+  {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+      PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && errno == EACCES)
+    {
+      // unprivileged processes may still count in user space
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    if (fd < 0)
+    {
+      if (m_error.empty())
+        m_error = std::string(name) + ": " + std::strerror(errno);
+      return;
+    }
+    m_counters.push_back(counter{name, fd});
+  }
+
+  void ioctl_all(unsigned long request)
+  {
+    for (const counter& c : m_counters)
+      ioctl(c.fd, request, 0);
+  }
+#endif
+
+public:
+  perf_counters()
+  : m_counters(),
+    m_error()
+  {
+#ifdef __linux__
+    open("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    open("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    open("cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    open("branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    open("context_switches", PERF_TYPE_SOFTWARE,
+      PERF_COUNT_SW_CONTEXT_SWITCHES);
+#else
+    m_error = "perf_event_open is only available on Linux";
+#endif
+  }
+
+  ~perf_counters()
+  {
+#ifdef __linux__
+    for (const counter& c : m_counters)
+      close(c.fd);
+#endif
+  }
+
+  perf_counters(const perf_counters&) = delete;
+  perf_counters& operator=(const perf_counters&) = delete;
+
+  /// Why the first unavailable counter could not be opened, if any
+  const std::string& error() const
+  {
+    return m_error;
+  }
+
+  /// Sets all counters to zero
+  void reset()
+  {
+#ifdef __linux__
+    ioctl_all(PERF_EVENT_IOC_RESET);
+#endif
+  }
+
+  void enable()
+  {
+#ifdef __linux__
+    ioctl_all(PERF_EVENT_IOC_ENABLE);
+#endif
+  }
+
+  void disable()
+  {
+#ifdef __linux__
+    ioctl_all(PERF_EVENT_IOC_DISABLE);
+#endif
+  }
+
+  /// Value of every available counter by name
+  std::map<std::string, double> read() const
+  {
+    std::map<std::string, double> values;
+#ifdef __linux__
+    for (const counter& c : m_counters)
+    {
+      // value, time enabled, time running
+      std::uint64_t data[3];
+      if (::read(c.fd, data, sizeof(data)) != sizeof(data))
+        continue;
+
+      values[c.name] = data[2] == 0 ? 0.0 :
+        static_cast<double>(data[0]) * data[1] / data[2];
+    }
+#endif
+    return values;
+  }
+};
+
+}
+
+#endif
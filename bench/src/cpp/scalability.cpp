@@ -0,0 +1,203 @@
+#include <channel>
+#include <array>
+#include <ctime>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include "bench.h"
+
+// Producer x consumer scalability matrix of cpp::channel
+//
+// Usage: scalability [--producers=P] [--consumers=C] [--messages=M] [--perf]
+//
+// For every number of producers p = 1, 2, 4, ..., P and consumers
+// c = 1, 2, 4, ..., C, where P and C are always included even if they
+// are no powers of two (both default to hardware_concurrency()), every
+// capacity in {0, 1, 64, 4096} and every payload size in {8, 64, 1024}
+// bytes, p threads send M (default 20000) messages in total into one
+// channel, from which c threads receive them. Every cell of the matrix
+// is written as a line of CSV to std::cout:
+//
+// - throughput: messages per second
+// - p50_ns, p90_ns, p99_ns, p999_ns, max_ns: latency percentiles from
+//   the start of a send to the end of the receive of the same message
+// - cpu_utilization: CPU time of the process per wall-clock time and
+//   hardware thread, so 1 means all hardware threads were busy
+// - with --perf, cycles, instructions, cache misses, branch misses and
+//   context switches per message; empty if a counter is unavailable
+
+static const char* const perf_columns[] = {"cycles", "instructions",
+  "cache_misses", "branch_misses", "context_switches"};
+
+template<std::size_t S>
+struct payload
+{
+  static_assert(S >= sizeof(std::int64_t), "payload too small");
+
+  // send time in nanoseconds since the clock's epoch
+  std::int64_t sent_ns;
+  std::array<char, S - sizeof(std::int64_t)> data;
+};
+
+static std::int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    bench::clock::now().time_since_epoch()).count();
+}
+
+static double cpu_seconds()
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+    return 0;
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Value below which the fraction q of the sorted samples lie
+static std::int64_t percentile(const std::vector<std::int64_t>& sorted,
+  double q)
+{
+  if (sorted.empty())
+    return 0;
+
+  const std::size_t i = static_cast<std::size_t>(q * sorted.size());
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+template<std::size_t N, std::size_t S>
+void cell(unsigned producers, unsigned consumers, std::size_t messages,
+  bool has_perf)
+{
+  cpp::channel<payload<S>, N> c;
+  std::vector<std::vector<std::int64_t>> latencies(consumers);
+  std::vector<std::thread> threads;
+
+  std::unique_ptr<bench::perf_counters> perf;
+  if (has_perf)
+  {
+    perf.reset(new bench::perf_counters());
+    perf->enable();
+  }
+
+  const double cpu_start = cpu_seconds();
+  const bench::clock::time_point start = bench::clock::now();
+
+  for (unsigned k = 0; k < consumers; k++)
+  {
+    const std::size_t n = messages / consumers + (k < messages % consumers);
+    latencies[k].reserve(n);
+    threads.emplace_back([c, n](std::vector<std::int64_t>& latency) mutable
+    {
+      for (std::size_t i = 0; i < n; i++)
+      {
+        const payload<S> p(c.recv());
+        latency.push_back(now_ns() - p.sent_ns);
+      }
+    }, std::ref(latencies[k]));
+  }
+  for (unsigned k = 0; k < producers; k++)
+  {
+    const std::size_t n = messages / producers + (k < messages % producers);
+    threads.emplace_back([c, n]() mutable
+    {
+      payload<S> p;
+      p.data.fill(0);
+      for (std::size_t i = 0; i < n; i++)
+      {
+        p.sent_ns = now_ns();
+        c.send(p);
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+
+  const std::chrono::duration<double> seconds = bench::clock::now() - start;
+  const double cpu = cpu_seconds() - cpu_start;
+
+  std::map<std::string, double> counts;
+  if (perf)
+  {
+    perf->disable();
+    counts = perf->read();
+  }
+
+  std::vector<std::int64_t> sorted;
+  sorted.reserve(messages);
+  for (const std::vector<std::int64_t>& latency : latencies)
+    sorted.insert(sorted.end(), latency.begin(), latency.end());
+  std::sort(sorted.begin(), sorted.end());
+
+  const unsigned hardware_threads =
+    std::max(1u, std::thread::hardware_concurrency());
+  std::cout << producers << ',' << consumers << ',' << N << ',' << S << ',' <<
+    messages << ',' << seconds.count() << ',' <<
+    messages / seconds.count() << ',' << percentile(sorted, 0.5) << ',' <<
+    percentile(sorted, 0.9) << ',' << percentile(sorted, 0.99) << ',' <<
+    percentile(sorted, 0.999) << ',' << (sorted.empty() ? 0 : sorted.back()) <<
+    ',' << cpu / (seconds.count() * hardware_threads);
+
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+    {
+      std::cout << ',';
+      if (counts.count(column))
+        std::cout << counts[column] / messages;
+    }
+  }
+  std::cout << std::endl;
+}
+
+template<std::size_t N>
+void row(unsigned producers, unsigned consumers, std::size_t messages,
+  bool has_perf)
+{
+  cell<N, 8>(producers, consumers, messages, has_perf);
+  cell<N, 64>(producers, consumers, messages, has_perf);
+  cell<N, 1024>(producers, consumers, messages, has_perf);
+}
+
+// Next count after n in 1, 2, 4, ..., max
+static unsigned next_count(unsigned n, unsigned max)
+{
+  return n == max ? max + 1 : std::min(2 * n, max);
+}
+
+int main(int argc, char* argv[])
+{
+  const unsigned hardware_threads =
+    std::max(1u, std::thread::hardware_concurrency());
+  const unsigned max_producers =
+    bench::flag(argc, argv, "--producers", hardware_threads);
+  const unsigned max_consumers =
+    bench::flag(argc, argv, "--consumers", hardware_threads);
+  const std::size_t messages = bench::flag(argc, argv, "--messages", 20000);
+  const bool has_perf = bench::has_flag(argc, argv, "--perf");
+
+  std::cout << "producers,consumers,capacity,payload,messages,seconds," <<
+    "throughput,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,cpu_utilization";
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+      std::cout << ',' << column << "_per_message";
+  }
+  std::cout << std::endl;
+
+  for (unsigned p = 1; p <= max_producers; p = next_count(p, max_producers))
+  {
+    for (unsigned c = 1; c <= max_consumers;
+         c = next_count(c, max_consumers))
+    {
+      row<0>(p, c, messages, has_perf);
+      row<1>(p, c, messages, has_perf);
+      row<64>(p, c, messages, has_perf);
+      row<4096>(p, c, messages, has_perf);
+    }
+  }
+  return EXIT_SUCCESS;
+}
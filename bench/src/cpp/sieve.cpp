@@ -1,83 +1,329 @@
 #include <channel>
+#include <deque>
 #include <vector>
+#include <cstdlib>
 #include <iostream>
+#include <functional>
+#include <condition_variable>
 
-// Send the sequence 2, 3, 4, ..., N to channel 'c'
-template<size_t N>
-void generate_numbers(cpp::ochannel<unsigned> c)
+#include <sys/resource.h>
+
+#include "bench.h"
+
+// Classical inefficient concurrent prime sieve
+//
+// \see http://blog.onideas.ws/eratosthenes.go
+// \see http://golang.org/test/chan/sieve1.go
+//
+// Usage: sieve [N [capacity [runtime]]] [bench flags]
+//
+// Finds the primes up to N (default 10000) with a chain of filters that
+// are connected by channels of the given capacity (0, 1, 8, 64 or 512;
+// default 0). Every filter runs either on its own thread ("threads") or
+// as a task on a pool of hardware_concurrency() threads ("pool"). By
+// default, both runtimes are measured. Every run reports the number of
+// primes, primes per second and context switches.
+
+// Number of voluntary and involuntary context switches of the process
+static long context_switches()
 {
-  for (unsigned i = 2; i <= N; i++)
-  {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// The numbers 2, 3, ..., n are followed by 0, which terminates the chain
+template<std::size_t C>
+void generate_numbers(cpp::ochannel<unsigned, C> c, unsigned n)
+{
+  for (unsigned i = 2; i <= n; i++)
     c.send(i);
-  }
+
+  c.send(0);
 }
 
-// Copy number n from channel 'in' to channel 'out' if and
-// only if n is not divisible by 'prime' and n < N.
-template<size_t N>
+// Copy number i from channel 'in' to channel 'out' if and
+// only if i is not divisible by 'prime'
+template<std::size_t C>
 void filter_numbers(
-  cpp::ichannel<unsigned> in,
-  cpp::ochannel<unsigned> out,
+  cpp::ichannel<unsigned, C> in,
+  cpp::ochannel<unsigned, C> out,
   const unsigned prime)
 {
-  unsigned i;
-  do
+  for (;;)
   {
-    i = in.recv();
-    if (i % prime != 0)
+    const unsigned i = in.recv();
+    if (i == 0 || i % prime != 0)
       out.send(i);
+
+    if (i == 0)
+      break;
   }
-  while (i < N);
 }
 
-// The prime sieve up to N: daisy-chain threads together
-template<size_t N>
-void sieve_numbers(cpp::channel<unsigned> primes)
+// One thread per filter, returns the number of primes up to n
+template<std::size_t C>
+std::size_t sieve_threads(unsigned n)
 {
-  cpp::channel<unsigned> c;
+  cpp::channel<unsigned, C> c;
   std::vector<std::thread> threads;
-  threads.emplace_back(generate_numbers<N>, c);
+  threads.emplace_back(generate_numbers<C>, c, n);
 
-  unsigned prime;
-  for (;;)
+  std::size_t primes = 0;
+  for (unsigned prime = c.recv(); prime != 0; prime = c.recv())
   {
-    prime = c.recv();
-    primes.send(prime);
-
-    if (prime >= N)
-      break;
-
-    cpp::channel<unsigned> c_prime;
-    threads.emplace_back(filter_numbers<N>, c, c_prime, prime);
+    primes++;
+    cpp::channel<unsigned, C> c_prime;
+    threads.emplace_back(filter_numbers<C>, c, c_prime, prime);
     c = c_prime;
   }
 
   for (std::thread& thread : threads)
     thread.join();
+
+  return primes;
 }
 
-// Classical inefficient concurrent prime sieve
+// Fixed number of threads that run tasks in FIFO order
 //
-// \see http://blog.onideas.ws/eratosthenes.go
-// \see http://golang.org/test/chan/sieve1.go
+// A task returns true when it is done; otherwise, it is queued again.
+// Since tasks must not block the threads of the pool, they only send
+// and receive if this does not block.
+class pool
+{
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::function<bool()>> m_tasks;
+  bool m_stop;
+  std::vector<std::thread> m_threads;
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+      m_cv.wait(lock, [this]{ return m_stop || !m_tasks.empty(); });
+      if (m_tasks.empty())
+        return;
+
+      std::function<bool()> task(std::move(m_tasks.front()));
+      m_tasks.pop_front();
+
+      lock.unlock();
+      const bool is_done = task();
+      lock.lock();
+
+      if (!is_done)
+        m_tasks.push_back(std::move(task));
+    }
+  }
+
+public:
+  explicit pool(unsigned threads)
+  : m_mutex(),
+    m_cv(),
+    m_tasks(),
+    m_stop(false),
+    m_threads()
+  {
+    for (unsigned i = 0; i < threads; i++)
+      m_threads.emplace_back(&pool::run, this);
+  }
+
+  // Waits for all tasks to be done
+  ~pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (std::thread& thread : m_threads)
+      thread.join();
+  }
+
+  void submit(std::function<bool()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push_back(std::move(task));
+    }
+    m_cv.notify_one();
+  }
+};
+
+// Operations per turn of a task, before it lets other tasks run
+constexpr unsigned batch = 64;
+
+template<std::size_t C>
+struct generate_task
+{
+  cpp::ochannel<unsigned, C> out;
+  unsigned n;
+  unsigned next;
+
+  bool operator()()
+  {
+    for (unsigned k = 0; k < batch; k++)
+    {
+      const unsigned i = next <= n ? next : 0;
+      if (!out.try_send(i))
+        return false;
+
+      if (i == 0)
+        return true;
+
+      next++;
+    }
+    return false;
+  }
+};
+
+template<std::size_t C>
+struct filter_task
+{
+  cpp::ichannel<unsigned, C> in;
+  cpp::ochannel<unsigned, C> out;
+  unsigned prime;
+
+  // received but not yet sent
+  unsigned pending;
+  bool is_pending;
+
+  bool operator()()
+  {
+    for (unsigned k = 0; k < batch; k++)
+    {
+      if (!is_pending)
+      {
+        if (!in.try_recv(pending))
+          return false;
+
+        is_pending = pending == 0 || pending % prime != 0;
+        if (!is_pending)
+          continue;
+      }
+
+      if (!out.try_send(pending))
+        return false;
+
+      is_pending = false;
+      if (pending == 0)
+        return true;
+    }
+    return false;
+  }
+};
+
+// One pool task per filter, returns the number of primes up to n
 //
-// TODO: use thread pool before reaching conclusions
-int main()
+// Sending into an unbuffered channel always waits for a receiver, so
+// this requires C > 0.
+template<std::size_t C>
+std::size_t sieve_pool(unsigned n)
 {
-  constexpr unsigned N = 94321;
+  static_assert(C > 0, "pool tasks require buffered channels");
+
+  const unsigned threads = std::thread::hardware_concurrency();
+  pool p(threads ? threads : 1);
 
-  cpp::channel<unsigned> primes;
-  std::thread sieve(sieve_numbers<N>, primes);
-  cpp::thread_guard sieve_guard(sieve);
+  cpp::channel<unsigned, C> c;
+  p.submit(generate_task<C>{c, n, 2});
 
-  unsigned p;
-  do
+  std::size_t primes = 0;
+  for (unsigned prime = c.recv(); prime != 0; prime = c.recv())
   {
-    p = primes.recv();
-    std::cout << p << std::endl;
+    primes++;
+    cpp::channel<unsigned, C> c_prime;
+    p.submit(filter_task<C>{c, c_prime, prime, 0, false});
+    c = c_prime;
   }
-  while (p < N);
+  return primes;
+}
+
+void measure(bench::suite& suite, const std::string& name, unsigned n,
+  std::function<std::size_t(unsigned)> sieve)
+{
+  suite.run(name, n, [sieve, n](bench::state& s)
+  {
+    const long switches = context_switches();
+    const std::size_t primes = sieve(n);
+    const std::chrono::duration<double> seconds =
+      bench::clock::now() - s.started();
 
-  return EXIT_SUCCESS;
+    s.counters["primes"] = primes;
+    s.counters["primes_per_second"] = primes / seconds.count();
+    s.counters["context_switches"] = context_switches() - switches;
+  });
 }
 
+template<std::size_t C>
+void run(bench::suite& suite, const std::string& runtime, unsigned n)
+{
+  const std::string name("sieve/" + runtime + "/capacity=" +
+    std::to_string(C) + "/N=" + std::to_string(n));
+
+  if (runtime == "threads")
+    measure(suite, name, n, sieve_threads<C>);
+  else
+    measure(suite, name, n, sieve_pool<C>);
+}
+
+// Unbuffered channels only support one thread per filter
+template<>
+void run<0>(bench::suite& suite, const std::string& runtime, unsigned n)
+{
+  if (runtime == "threads")
+    measure(suite, "sieve/threads/capacity=0/N=" + std::to_string(n), n,
+      sieve_threads<0>);
+  else
+    std::cerr << "skipping " << runtime << ": capacity 0 requires threads" <<
+      std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::string(argv[i]).compare(0, 2, "--") != 0)
+      args.push_back(argv[i]);
+  }
+
+  const unsigned n = args.size() > 0 ? std::stoul(args[0]) : 10000;
+  const unsigned capacity = args.size() > 1 ? std::stoul(args[1]) : 0;
+  std::vector<std::string> runtimes;
+  if (args.size() > 2)
+    runtimes.push_back(args[2]);
+  else
+    runtimes = {"threads", "pool"};
+
+  bench::suite suite(argc, argv);
+  for (const std::string& runtime : runtimes)
+  {
+    if (runtime != "threads" && runtime != "pool")
+    {
+      std::cerr << "unknown runtime " << runtime <<
+        ", expected threads or pool" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    switch (capacity)
+    {
+    case 0: run<0>(suite, runtime, n); break;
+    case 1: run<1>(suite, runtime, n); break;
+    case 8: run<8>(suite, runtime, n); break;
+    case 64: run<64>(suite, runtime, n); break;
+    case 512: run<512>(suite, runtime, n); break;
+    default:
+      std::cerr << "unsupported capacity " << capacity <<
+        ", expected 0, 1, 8, 64 or 512" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return suite.finish();
+}
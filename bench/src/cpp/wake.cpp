@@ -0,0 +1,197 @@
+#include <channel>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "histogram.h"
+
+// Wake policies of a worker pool under partial load
+//
+// Usage: wake [--workers=W] [--rate=R] [--work-kb=K] [--duration-ms=D]
+//             [--perf]
+//
+// W (default 16) workers block on one channel. A generator offers jobs
+// at a fixed rate of R (default 20000) jobs per second for D (default
+// 1000) milliseconds, so that only part of the pool is needed. For each
+// job, a worker reads K (default 32) kilobytes of its own buffer, which
+// stays in the cache only if the worker runs often. For every wake
+// policy, a line of CSV is written to std::cout with
+//
+// - achieved_rate: jobs per second, including the time to catch up
+// - active_workers: workers that did at least 1% of the jobs
+// - p50_ns, p99_ns, max_ns: latency from the intended send time of a
+//   job to the end of its work
+// - voluntary_switches_per_job: context switches because a thread
+//   blocked; workers that stay busy block less often
+// - with --perf, cycles, instructions, cache misses and branch misses
+//   per job; empty if a counter is unavailable
+
+static const char* const perf_columns[] = {"cycles", "instructions",
+  "cache_misses", "branch_misses"};
+
+// Sent instead of a job to stop a worker
+constexpr std::int64_t quit = -1;
+
+static std::int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    bench::clock::now().time_since_epoch()).count();
+}
+
+static long voluntary_switches()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return usage.ru_nvcsw;
+}
+
+struct worker_result
+{
+  std::uint64_t jobs;
+  bench::histogram latency;
+};
+
+static void work(cpp::ichannel<std::int64_t, 16> jobs, std::size_t bytes,
+  worker_result& result)
+{
+  std::vector<unsigned char> buffer(bytes, 1);
+  unsigned sum = 0;
+  for (std::int64_t intended = jobs.recv(); intended != quit;
+       intended = jobs.recv())
+  {
+    // one read per cache line
+    for (std::size_t i = 0; i < bytes; i += 64)
+      sum += buffer[i];
+
+    result.jobs++;
+    result.latency.record(std::max<std::int64_t>(0, now_ns() - intended));
+  }
+  bench::do_not_optimize(sum);
+}
+
+static const char* name(cpp::wake_policy policy)
+{
+  switch (policy)
+  {
+  case cpp::wake_policy::any:
+    return "any";
+  case cpp::wake_policy::fifo:
+    return "fifo";
+  case cpp::wake_policy::lifo:
+    return "lifo";
+  }
+  return "unknown";
+}
+
+void run(cpp::wake_policy policy, unsigned workers, double rate,
+  std::size_t bytes, std::chrono::milliseconds duration, bool has_perf)
+{
+  cpp::channel<std::int64_t, 16> jobs;
+  jobs.set_wake_policy(policy);
+
+  std::unique_ptr<bench::perf_counters> perf;
+  if (has_perf)
+  {
+    perf.reset(new bench::perf_counters());
+    perf->enable();
+  }
+
+  std::vector<worker_result> results(workers,
+    worker_result{0, bench::histogram()});
+  std::vector<std::thread> threads;
+  for (unsigned k = 0; k < workers; k++)
+    threads.emplace_back(work, jobs, bytes, std::ref(results[k]));
+
+  // let all workers block before the load starts
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  const long voluntary_start = voluntary_switches();
+  const std::int64_t start = now_ns();
+  const std::int64_t end = start +
+    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  const std::int64_t interval = static_cast<std::int64_t>(1e9 / rate);
+
+  std::uint64_t sent = 0;
+  for (std::int64_t intended = start; intended < end; intended += interval)
+  {
+    const std::int64_t now = now_ns();
+    if (intended > now)
+      std::this_thread::sleep_for(std::chrono::nanoseconds(intended - now));
+
+    jobs.send(intended);
+    sent++;
+  }
+  const double seconds = (now_ns() - start) * 1e-9;
+
+  for (unsigned k = 0; k < workers; k++)
+    jobs.send(quit);
+  for (std::thread& thread : threads)
+    thread.join();
+
+  const long voluntary = voluntary_switches() - voluntary_start;
+  std::map<std::string, double> counts;
+  if (perf)
+  {
+    perf->disable();
+    counts = perf->read();
+  }
+
+  bench::histogram latency;
+  unsigned active = 0;
+  for (const worker_result& r : results)
+  {
+    latency.merge(r.latency);
+    if (r.jobs * 100 >= sent)
+      active++;
+  }
+
+  const double per_job = sent > 0 ? 1.0 / sent : 0;
+  std::cout << name(policy) << ',' << workers << ',' << rate << ',' <<
+    sent << ',' << sent / seconds << ',' << active << ',' <<
+    latency.percentile(0.5) << ',' << latency.percentile(0.99) << ',' <<
+    latency.max() << ',' << voluntary * per_job;
+
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+    {
+      std::cout << ',';
+      if (counts.count(column))
+        std::cout << counts[column] * per_job;
+    }
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  const unsigned workers =
+    std::max(1ul, bench::flag(argc, argv, "--workers", 16));
+  const double rate = std::max(1ul, bench::flag(argc, argv, "--rate", 20000));
+  const std::size_t bytes = bench::flag(argc, argv, "--work-kb", 32) * 1024;
+  const std::chrono::milliseconds duration(
+    bench::flag(argc, argv, "--duration-ms", 1000));
+  const bool has_perf = bench::has_flag(argc, argv, "--perf");
+
+  std::cout << "policy,workers,rate,jobs,achieved_rate,active_workers," <<
+    "p50_ns,p99_ns,max_ns,voluntary_switches_per_job";
+  if (has_perf)
+  {
+    for (const char* column : perf_columns)
+      std::cout << ',' << column << "_per_job";
+  }
+  std::cout << std::endl;
+
+  for (cpp::wake_policy policy : {cpp::wake_policy::any,
+       cpp::wake_policy::fifo, cpp::wake_policy::lifo})
+    run(policy, workers, rate, bytes, duration, has_perf);
+
+  return EXIT_SUCCESS;
+}
@@ -6,6 +6,7 @@
 #define CPP_CHANNEL_H
 
 #include <mutex>
+#include <chrono>
 #include <deque>
 #include <vector>
 #include <limits>
@@ -18,12 +19,33 @@
 #include <type_traits>
 #include <condition_variable>
 
+#include <channel_hook.h>
+
 namespace cpp
 {
 
+/// Which of the threads blocked on a channel an element wakes up
+
+/// With wake_policy::any, the operating system picks a thread, which is
+/// cheapest if few threads block. wake_policy::fifo wakes the thread that
+/// has blocked longest, so that no thread waits indefinitely while others
+/// are served. wake_policy::lifo wakes the thread that blocked last; in a
+/// pool of workers that receive from one channel, the busy workers keep
+/// their caches warm while the surplus ones stay asleep.
+///
+/// \see channel<T, N>::set_wake_policy()
+enum class wake_policy : unsigned char
+{
+  any,
+  fifo,
+  lifo
+};
+
 namespace internal
 {
 
+struct _access;
+
 #if __cplusplus <= 201103L
 // since C++14 in std, see Herb Sutter's blog
 template<class T, class ...Args>
@@ -42,6 +64,207 @@ struct _is_exception_safe :
     std::is_nothrow_move_constructible<T>::value>
 {};
 
+// Observes elements as they are enqueued, see channel<T, N>::tap()
+template<class T>
+class _tap
+{
+public:
+  virtual ~_tap() {}
+
+  // \pre: calling thread owns the lock of the tapped channel
+  virtual void mirror(const T&) = 0;
+};
+
+template<class T, class U, std::size_t M, class Projection>
+class _sampling_tap;
+
+// Counts a receiver while it waits with the channel's lock released, so
+// that an unbuffered try_send() can count on it. Once it wakes up, the
+// receiver holds the lock until it has dequeued an element.
+class _recv_ready_scope
+{
+private:
+  std::size_t& m_recv_ready;
+
+public:
+  explicit _recv_ready_scope(std::size_t& recv_ready)
+  : m_recv_ready(recv_ready)
+  {
+    m_recv_ready++;
+  }
+
+  ~_recv_ready_scope()
+  {
+    m_recv_ready--;
+  }
+
+  _recv_ready_scope(const _recv_ready_scope&) = delete;
+  _recv_ready_scope& operator=(const _recv_ready_scope&) = delete;
+};
+
+// Thread parked in a select_any() until one of its channels is nonempty
+struct _waiter
+{
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool is_notified;
+
+  _waiter()
+  : mutex(),
+    cv(),
+    is_notified(false) {}
+
+  // Returns false if the waiter had been notified already
+  bool notify()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (is_notified)
+        return false;
+
+      is_notified = true;
+    }
+    cv.notify_one();
+    return true;
+  }
+};
+
+// Links a waiter into the list of one channel
+struct _waiter_node
+{
+  _waiter* waiter;
+  _waiter_node* next;
+
+  // Is the waiter only interested in some elements, and must thus be
+  // notified of every enqueue?
+  bool is_selective;
+};
+
+// Nodes of a waiter that parks on n channels, which are on the stack
+// unless n is large
+class _waiter_nodes
+{
+private:
+  static constexpr std::size_t s_inline_size = 8;
+
+  _waiter_node m_inline[s_inline_size];
+  std::unique_ptr<_waiter_node[]> m_heap;
+  _waiter_node* m_nodes;
+
+public:
+  _waiter_nodes(std::size_t n, _waiter& waiter)
+  : m_inline(),
+    m_heap(n > s_inline_size ? new _waiter_node[n] : nullptr),
+    m_nodes(m_heap ? m_heap.get() : m_inline)
+  {
+    for (std::size_t i = 0; i < n; i++)
+      m_nodes[i] = _waiter_node{&waiter, nullptr, false};
+  }
+
+  _waiter_nodes(const _waiter_nodes&) = delete;
+  _waiter_nodes& operator=(const _waiter_nodes&) = delete;
+
+  _waiter_node& operator[](std::size_t i)
+  {
+    return m_nodes[i];
+  }
+};
+
+// Threads blocked on a channel in the order in which they blocked, so
+// that one of them can be woken by its position rather than by whichever
+// thread a std::condition_variable picks. Every thread waits on the cv
+// of its own node with the channel's lock.
+//
+// All member functions require the calling thread to own the lock.
+class _wait_list
+{
+public:
+  struct node
+  {
+    std::condition_variable cv;
+    bool is_notified;
+    node* prev;
+    node* next;
+
+    node()
+    : cv(),
+      is_notified(false),
+      prev(nullptr),
+      next(nullptr) {}
+  };
+
+private:
+  node* m_head;
+  node* m_tail;
+
+public:
+  _wait_list()
+  : m_head(nullptr),
+    m_tail(nullptr) {}
+
+  _wait_list(const _wait_list&) = delete;
+  _wait_list& operator=(const _wait_list&) = delete;
+
+  void push_back(node& n)
+  {
+    n.is_notified = false;
+    n.prev = m_tail;
+    n.next = nullptr;
+    if (m_tail)
+      m_tail->next = &n;
+    else
+      m_head = &n;
+    m_tail = &n;
+  }
+
+  void push_front(node& n)
+  {
+    n.is_notified = false;
+    n.prev = nullptr;
+    n.next = m_head;
+    if (m_head)
+      m_head->prev = &n;
+    else
+      m_tail = &n;
+    m_head = &n;
+  }
+
+  // \pre: n is in this list
+  void remove(node& n)
+  {
+    if (n.prev)
+      n.prev->next = n.next;
+    else
+      m_head = n.next;
+
+    if (n.next)
+      n.next->prev = n.prev;
+    else
+      m_tail = n.prev;
+  }
+
+  // Removes the longest or most recently blocked thread, if any, and
+  // wakes it up. The lock must not be released in between: once the
+  // woken thread owns it again, it may destroy its node.
+  void notify_one(bool is_lifo)
+  {
+    node* n = is_lifo ? m_tail : m_head;
+    if (n == nullptr)
+      return;
+
+    remove(*n);
+    n->is_notified = true;
+    n->cv.notify_one();
+  }
+
+  // Like notify_one() for every blocked thread
+  void notify_all()
+  {
+    while (m_head)
+      notify_one(false);
+  }
+};
+
 // Note that currently handshakes between send/receives inside selects
 // have higher priority compared to sends/receives outside selects.
 
@@ -63,10 +286,137 @@ private:
 
   bool m_is_send_done;
   bool m_is_try_send_done;
-  bool m_is_recv_ready;
   bool m_is_try_send_ready;
   bool m_is_try_recv_ready;
 
+  // number of threads waiting in a blocking receive
+  std::size_t m_recv_ready;
+
+  // number of elements enqueued and dequeued so far, respectively; the
+  // positions of withdrawn elements count as dequeued once all earlier
+  // elements have been dequeued
+  std::uint64_t m_enqueued;
+  std::uint64_t m_dequeued;
+
+  // positions of withdrawn elements that m_dequeued has yet to reach,
+  // in increasing order
+  std::vector<std::uint64_t> m_withdrawn;
+
+  _parties m_parties;
+
+  // null unless tapped
+  std::unique_ptr<_tap<T>> m_tap;
+
+  // waiters to notify on every enqueue, usually none
+  _waiter_node* m_waiters;
+
+  // unless m_wake_policy is any, threads blocked in a receive and
+  // blocked until they can enqueue, respectively
+  wake_policy m_wake_policy;
+  _wait_list m_recv_waiters;
+  _wait_list m_send_waiters;
+
+  // Appends n to list, except that a thread whose wake-up was taken
+  // by another thread keeps its place at the front of a FIFO
+  void _enlist(_wait_list& list, _wait_list::node& n, bool is_woken)
+  {
+    if (is_woken && m_wake_policy == wake_policy::fifo)
+      list.push_front(n);
+    else
+      list.push_back(n);
+  }
+
+  // Like cv.wait(lock, pred), but in the order of m_wake_policy. When
+  // the policy changes, set_wake_policy() wakes all waiting threads, so
+  // that they wait again according to the new one.
+  template<class Predicate>
+  void _wait(std::condition_variable& cv, _wait_list& list,
+    std::unique_lock<std::mutex>& lock, Predicate pred)
+  {
+    _wait_list::node n;
+    for (bool is_woken = false; !pred(); is_woken = true)
+    {
+      if (m_wake_policy == wake_policy::any)
+      {
+        cv.wait(lock);
+        continue;
+      }
+
+      _enlist(list, n, is_woken);
+      try
+      {
+        n.cv.wait(lock, [&n]{ return n.is_notified; });
+      }
+      catch (...)
+      {
+        if (!n.is_notified)
+          list.remove(n);
+        throw;
+      }
+    }
+  }
+
+  // Like cv.wait_until(lock, deadline, pred), but in the order of
+  // m_wake_policy, see _wait()
+  template<class Predicate>
+  bool _wait_until(std::condition_variable& cv, _wait_list& list,
+    std::unique_lock<std::mutex>& lock,
+    std::chrono::steady_clock::time_point deadline, Predicate pred)
+  {
+    _wait_list::node n;
+    for (bool is_woken = false; !pred(); is_woken = true)
+    {
+      if (m_wake_policy == wake_policy::any)
+      {
+        if (cv.wait_until(lock, deadline) == std::cv_status::timeout)
+          return pred();
+
+        continue;
+      }
+
+      _enlist(list, n, is_woken);
+      bool is_notified = false;
+      try
+      {
+        is_notified = n.cv.wait_until(lock, deadline,
+          [&n]{ return n.is_notified; });
+      }
+      catch (...)
+      {
+        if (!n.is_notified)
+          list.remove(n);
+        throw;
+      }
+
+      if (!is_notified)
+      {
+        list.remove(n);
+        return pred();
+      }
+    }
+    return true;
+  }
+
+  // Wakes up one thread blocked on cv or in list, see _wait()
+  //
+  // \pre: calling thread owns lock
+  // \post: calling thread doesn't own lock anymore
+  void _notify(std::condition_variable& cv, _wait_list& list,
+    std::unique_lock<std::mutex>& lock)
+  {
+    if (m_wake_policy == wake_policy::any)
+    {
+      // unlock before notifying threads; otherwise, the
+      // notified thread would unnecessarily block again
+      lock.unlock();
+      cv.notify_one();
+      return;
+    }
+
+    list.notify_one(m_wake_policy == wake_policy::lifo);
+    lock.unlock();
+  }
+
   bool is_full() const
   {
     return m_queue.size() > N;
@@ -85,8 +435,16 @@ private:
   // \post: queue is nonempty and calling thread still owns lock
   void _pre_blocking_recv(std::unique_lock<std::mutex>& lock)
   {
-    m_is_recv_ready = true;
-    m_recv_cv.wait(lock, [this]{ return !m_queue.empty(); });
+    if (m_queue.empty())
+    {
+      _hook(_event::recv_block, this);
+      CPP_CHANNEL_PROBE(recv_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::recv);
+      _recv_ready_scope ready(m_recv_ready);
+      _wait(m_recv_cv, m_recv_waiters, lock,
+        [this]{ return !m_queue.empty(); });
+      CPP_CHANNEL_PROBE(recv_wake, this, m_queue.size(), sizeof(T));
+    }
 
     // TODO: support the case where both ends of a channel are inside a select
     assert(!is_try_ready());
@@ -98,6 +456,15 @@ private:
   // \post: calling thread doesn't own lock anymore, and protocol with
   //    try_send() and try_recv() is fulfilled
   void _post_blocking_recv(std::unique_lock<std::mutex>& lock)
+  {
+    _pop_front();
+    _notify_sender(lock);
+  }
+
+  // Pop front of queue without notifying a _send()
+  //
+  // \pre: calling thread must own lock and queue is nonempty
+  void _pop_front()
   {
     // If queue is full, then there exists either a _send() waiting
     // for m_send_end_cv, or try_send() has just enqueued an element.
@@ -112,13 +479,23 @@ private:
 
     m_queue.pop_front();
     assert(!is_full());
+    _hook(_event::dequeue, this, _next_dequeued(), sizeof(T));
+    CPP_CHANNEL_PROBE(dequeue, this, m_queue.size(), sizeof(T));
+    m_parties.last_receiver.store(std::this_thread::get_id(),
+      std::memory_order_relaxed);
 
     // protocol with nonblocking calls
     m_is_try_send_done = true;
-    m_is_recv_ready = false;
     m_is_try_recv_ready = false;
     m_is_try_send_ready = false;
+  }
 
+  // Unblocks one _send() (if any) after elements have been popped
+  //
+  // \pre: calling thread owns lock
+  // \post: calling thread doesn't own lock anymore
+  void _notify_sender(std::unique_lock<std::mutex>& lock)
+  {
     // Consider two concurrent _send() calls denoted by s and s'.
     //
     // Suppose s is waiting to enqueue an element (i.e. m_send_begin_cv),
@@ -135,12 +512,8 @@ private:
     // in case that it waited on m_is_try_send_done to become true.
     if (m_is_send_done)
     {
-      // unlock before notifying threads; otherwise, the
-      // notified thread would unnecessarily block again
-      lock.unlock();
-
       // nonblocking, see also note below about notifications
-      m_send_begin_cv.notify_one();
+      _notify(m_send_begin_cv, m_send_waiters, lock);
     }
     else
     {
@@ -160,15 +533,166 @@ private:
     }
   }
 
+  // Position of the element that is being dequeued in the FIFO order
+  //
+  // \pre: calling thread owns lock
+  std::uint64_t _next_dequeued()
+  {
+    const std::uint64_t seq = m_dequeued++;
+    _skip_withdrawn();
+    return seq;
+  }
+
+  // \pre: calling thread owns lock
+  void _skip_withdrawn()
+  {
+    while (!m_withdrawn.empty() && m_withdrawn.front() == m_dequeued)
+    {
+      m_withdrawn.erase(m_withdrawn.begin());
+      m_dequeued++;
+    }
+  }
+
+  // Remove the most recently enqueued element, which is at the back of
+  // the queue, such that it is never received. Its position in the FIFO
+  // order is not reused, so that every position identifies one element.
+  //
+  // \pre: calling thread owns lock, and no element has been enqueued
+  //    since the one at the back of the queue
+  void _withdraw_back()
+  {
+    const std::uint64_t seq = m_enqueued - 1;
+    m_queue.pop_back();
+    m_withdrawn.push_back(seq);
+    _skip_withdrawn();
+    _hook(_event::withdraw, this, seq, sizeof(T));
+    CPP_CHANNEL_PROBE(withdraw, this, m_queue.size(), sizeof(T));
+  }
+
+  // Append u to the queue
+  //
+  // \pre: calling thread owns lock and queue is not full
+  // \post: nothing changes if the tap throws
+  template<class U>
+  void _enqueue(U&& u)
+  {
+    if (m_tap)
+      m_tap->mirror(u);
+
+    m_queue.emplace_back(std::this_thread::get_id(), std::forward<U>(u));
+    _hook(_event::enqueue, this, m_enqueued++, sizeof(T));
+    CPP_CHANNEL_PROBE(enqueue, this, m_queue.size(), sizeof(T));
+    m_parties.last_sender.store(std::this_thread::get_id(),
+      std::memory_order_relaxed);
+
+    _notify_waiters(true);
+  }
+
+  // Notifies the first waiter that has not been notified already and,
+  // if is_enqueue, every selective waiter. Since each notified waiter
+  // can take at most one element, waking more would only make them
+  // compete.
+  //
+  // \pre: calling thread owns lock
+  void _notify_waiters(bool is_enqueue)
+  {
+    bool is_woken = false;
+    for (_waiter_node* node = m_waiters; node != nullptr; node = node->next)
+    {
+      if (node->is_selective)
+      {
+        if (is_enqueue)
+          node->waiter->notify();
+      }
+      else if (!is_woken)
+        is_woken = node->waiter->notify();
+    }
+  }
+
+  // Enqueue make() if this does not have to wait for a receiver; make
+  // is only invoked if so, and nothing changes if it throws
+  //
+  // \pre: calling thread must own lock
+  // \post: calling thread doesn't own lock anymore unless make threw
+  template<class Factory>
+  bool _try_send_lazy(std::unique_lock<std::mutex>&, Factory&&);
+
+  template<class U>
+  bool _try_send(std::unique_lock<std::mutex>& lock, U&& u)
+  {
+    return _try_send_lazy(lock, [&u]() -> U&& { return std::forward<U>(u); });
+  }
+
+  // Remove the i-th element of the queue (by default, its front) and
+  // unblock one _send() (if any)
+  //
+  //
+  // \pre: calling thread must own lock and i < queue size
+  // \post: calling thread doesn't own lock anymore
+  void _post_try_recv(std::unique_lock<std::mutex>&, std::size_t i = 0);
+
+  // Index of the first of at most max_depth queued elements that
+  // satisfies pred, or the size of the queue if there is none
+  //
+  // \pre: calling thread must own lock
+  template<class Predicate>
+  std::size_t _find_if(Predicate& pred, std::size_t max_depth) const
+  {
+    const std::size_t n = std::min(max_depth, m_queue.size());
+    for (std::size_t i = 0; i < n; i++)
+    {
+      if (pred(static_cast<const T&>(m_queue[i].second)))
+        return i;
+    }
+    return m_queue.size();
+  }
+
+  // Move the i-th element of the queue into t, and remove it
+  //
+  // \pre: calling thread must own lock and i < queue size
+  // \post: calling thread doesn't own lock anymore unless the
+  //    assignment threw, in which case the queue is unchanged
+  void _recv_at(std::unique_lock<std::mutex>& lock, std::size_t i, T& t)
+  {
+    // see also try_recv_ptr()
+    assert(!is_full() || !m_is_send_done || !m_is_try_send_done);
+    assert(m_is_try_send_done || m_is_send_done);
+    assert(!is_full() || std::this_thread::get_id() != m_queue[i].first);
+
+    // assignment before erasing to ensure strong exception safety
+    t = std::move(m_queue[i].second);
+    _post_try_recv(lock, i);
+  }
+
+  // \pre: calling thread must own lock and node is parked
+  void _unlink(_waiter_node& node)
+  {
+    _waiter_node** link = &m_waiters;
+    while (*link != &node)
+      link = &(*link)->next;
+    *link = node.next;
+  }
+
   template<class U>
   void _send(U&&);
 
+  template<class U>
+  bool _send_until(U&&, std::chrono::steady_clock::time_point);
+
 public:
   // \pre: calling thread must own mutex()
   // \post: calling thread doesn't own mutex() anymore
   template<class U>
   bool try_send(std::unique_lock<std::mutex>&, U&&);
 
+  // Like try_send(lock, make()), except that make is only invoked if
+  // the element is enqueued
+  //
+  // \pre: calling thread must own mutex()
+  // \post: calling thread doesn't own mutex() anymore unless make threw
+  template<class Factory>
+  bool try_send_lazy(std::unique_lock<std::mutex>&, Factory&&);
+
   // \pre: calling thread must own mutex()
   // \post: calling thread doesn't own mutex() anymore
   std::pair<bool, std::unique_ptr<T>> try_recv_ptr(
@@ -185,9 +709,18 @@ public:
     m_queue(),
     m_is_send_done(true),
     m_is_try_send_done(true),
-    m_is_recv_ready(false),
     m_is_try_send_ready(false),
-    m_is_try_recv_ready(false) {}
+    m_is_try_recv_ready(false),
+    m_recv_ready(0),
+    m_enqueued(0),
+    m_dequeued(0),
+    m_withdrawn(),
+    m_parties(),
+    m_tap(),
+    m_waiters(nullptr),
+    m_wake_policy(wake_policy::any),
+    m_recv_waiters(),
+    m_send_waiters() {}
 
   // channel lock
   std::mutex& mutex()
@@ -195,6 +728,59 @@ public:
     return m_mutex;
   }
 
+  // number of queued elements
+  //
+  // \pre: calling thread must own mutex()
+  std::size_t depth() const
+  {
+    return m_queue.size();
+  }
+
+  // Until unpark(node), node's waiter may be notified of an enqueue,
+  // see _notify_waiters(); returns whether the queue is nonempty already
+  bool park(_waiter_node& node)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    node.next = m_waiters;
+    m_waiters = &node;
+    return !m_queue.empty();
+  }
+
+  // Once this returns, node's waiter is no longer notified. If an
+  // element is left, e.g. because the waiter was notified of it but took
+  // an element of another channel, another waiter is notified instead.
+  void unpark(_waiter_node& node)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    _unlink(node);
+    if (!m_queue.empty())
+      _notify_waiters(false);
+  }
+
+  // Wakes all blocked threads so that they wait again according to the
+  // new policy, see _wait()
+  void set_wake_policy(wake_policy policy)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_wake_policy == policy)
+        return;
+
+      m_wake_policy = policy;
+      m_recv_waiters.notify_all();
+      m_send_waiters.notify_all();
+    }
+    m_recv_cv.notify_all();
+    m_send_begin_cv.notify_all();
+  }
+
+  // Replaces the current tap, if any; nullptr removes it
+  void tap(std::unique_ptr<_tap<T>> t)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tap.swap(t);
+  }
+
   // Propagates exceptions thrown by std::condition_variable::wait()
   void send(const T& t)
   {
@@ -215,8 +801,81 @@ public:
 
   // Propagates exceptions thrown by std::condition_variable::wait()
   std::unique_ptr<T> recv_ptr();
+
+  // Blocks until an element is available, then moves at most k queued
+  // elements, in order, to the end of v and returns how many. Since
+  // only one _send() at a time waits for its element to be dequeued,
+  // notifying one sender after the last pop is enough.
+  //
+  // \pre: k > 0
+  //
+  // Propagates exceptions thrown by std::condition_variable::wait() and
+  // by the move constructor of T; in the latter case, the elements that
+  // have been moved already are received nonetheless
+  std::size_t recv_n(std::vector<T>& v, std::size_t k);
+
+  // Unlike try_send(lock, u), this is not part of a select
+  template<class U>
+  bool try_send(U&& u)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return _try_send(lock, std::forward<U>(u));
+  }
+
+  // Like try_send(make()), except that it also gives up while another
+  // thread owns the lock, and make is only invoked if the element is
+  // enqueued
+  template<class Factory>
+  bool try_lock_send(Factory&& make)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return false;
+
+    return _try_send_lazy(lock, std::forward<Factory>(make));
+  }
+
+  // Unlike try_recv_ptr(lock), this is not part of a select
+  bool try_recv(T&);
+
+  // Propagates exceptions thrown by pred
+  template<class Predicate>
+  bool try_recv_if(Predicate pred, T&, std::size_t max_depth);
+
+  // Propagates exceptions thrown by pred and by
+  // std::condition_variable::wait()
+  template<class Predicate>
+  void recv_if(Predicate pred, T&, std::size_t max_depth);
+
+  // Propagates exceptions thrown by std::condition_variable::wait_until()
+  template<class U>
+  bool send_until(U&& u, std::chrono::steady_clock::time_point deadline)
+  {
+    return _send_until(std::forward<U>(u), deadline);
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait_until()
+  bool recv_until(T&, std::chrono::steady_clock::time_point);
 };
 
+// Deadline after the given timeout, saturated at the largest time point
+template<class Rep, class Period>
+std::chrono::steady_clock::time_point _deadline(
+  const std::chrono::duration<Rep, Period>& timeout)
+{
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point now = clock::now();
+  if (timeout <= timeout.zero())
+    return now;
+
+  // compare in floating point, where timeout cannot overflow
+  typedef std::chrono::duration<double> seconds;
+  if (seconds(timeout) >= seconds(clock::time_point::max() - now))
+    return clock::time_point::max();
+
+  return now + std::chrono::duration_cast<clock::duration>(timeout);
+}
+
 }
 
 template<class T, std::size_t N> class ichannel;
@@ -254,6 +913,7 @@ static_assert(N < std::numeric_limits<std::size_t>::max(),
 private:
   friend class ichannel<T, N>;
   friend class ochannel<T, N>;
+  friend struct internal::_access;
 
   std::shared_ptr<internal::_channel<T, N>> m_channel_ptr;
 
@@ -319,6 +979,156 @@ public:
   {
     m_channel_ptr->recv(t);
   }
+
+  /// Sends t if that does not block, and returns whether it did
+
+  /// A buffered channel accepts t if its queue has room, an unbuffered
+  /// one only if a receiver is already waiting. Unlike a select, this
+  /// neither allocates nor polls.
+  bool try_send(const T& t)
+  {
+    return m_channel_ptr->try_send(t);
+  }
+
+  bool try_send(T&& t)
+  {
+    return m_channel_ptr->try_send(std::move(t));
+  }
+
+  /// Sends t unless that takes longer than timeout
+
+  /// Returns true once t has been enqueued and, like send(), the channel
+  /// is no longer full, i.e. t has been received by some thread if the
+  /// channel is unbuffered. Otherwise, returns false and t is withdrawn,
+  /// so that it will never be received, though a tap may have mirrored
+  /// it. Propagates exceptions thrown by
+  /// std::condition_variable::wait_until()
+  template<class Rep, class Period>
+  bool send_for(const T& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->send_until(t, internal::_deadline(timeout));
+  }
+
+  template<class Rep, class Period>
+  bool send_for(T&& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->send_until(std::move(t),
+      internal::_deadline(timeout));
+  }
+
+  /// Receives into t if an element is available, and returns whether it was
+
+  /// Unlike a select, this neither allocates nor polls.
+  bool try_recv(T& t)
+  {
+    return m_channel_ptr->try_recv(t);
+  }
+
+  /// Receives into t unless no element arrives within timeout
+
+  /// Returns false, leaving t unchanged, if the timeout expired.
+  /// Propagates exceptions thrown by std::condition_variable::wait_until()
+  template<class Rep, class Period>
+  bool recv_for(T& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->recv_until(t, internal::_deadline(timeout));
+  }
+
+  /// Receives the first queued element that satisfies pred, if any
+
+  /// Scans at most max_depth elements from the front of the queue while
+  /// owning the channel's lock, so pred should be cheap and must not use
+  /// the channel. The match is removed wherever it is in the queue; all
+  /// other elements keep their order. Returns false, leaving t unchanged,
+  /// if no scanned element satisfies pred.
+  ///
+  /// Propagates exceptions thrown by pred
+  template<class Predicate>
+  bool try_recv_if(Predicate pred, T& t,
+    std::size_t max_depth = std::numeric_limits<std::size_t>::max())
+  {
+    return m_channel_ptr->try_recv_if(pred, t, max_depth);
+  }
+
+  /// Blocks until it has received an element that satisfies pred
+
+  /// Like try_recv_if(), but while no scanned element matches, waits for
+  /// the next enqueue and scans again. Elements that become scannable
+  /// because others dequeued elements ahead of them are only noticed on
+  /// the next enqueue.
+  ///
+  /// Unlike a blocked recv(), a blocked recv_if() does not let try_send()
+  /// or a send case of a select enqueue into an unbuffered channel, since
+  /// it might reject the element and leave the sender's handshake open.
+  ///
+  /// Propagates exceptions thrown by pred and by
+  /// std::condition_variable::wait()
+  template<class Predicate>
+  void recv_if(Predicate pred, T& t,
+    std::size_t max_depth = std::numeric_limits<std::size_t>::max())
+  {
+    m_channel_ptr->recv_if(pred, t, max_depth);
+  }
+
+  /// Chooses which blocked thread wakes up when the channel is ready
+
+  /// The policy applies to the receivers waiting for an element and to
+  /// the senders waiting for room in the queue; it defaults to
+  /// wake_policy::any. Threads that are blocked when the policy changes
+  /// wait again according to the new policy; among each other, they lose
+  /// their order, so the policy is best set right after the channel has
+  /// been created.
+  void set_wake_policy(wake_policy policy)
+  {
+    m_channel_ptr->set_wake_policy(policy);
+  }
+
+  /// Mirrors a sample of the sent elements to another channel
+
+  /// Of all elements sent from now on, a fraction sample_rate in [0, 1]
+  /// is copied to out, which is meant for debugging. If out cannot take
+  /// an element without blocking (e.g. its queue is full, or another
+  /// thread owns its lock), the copy is dropped. To stop, call untap();
+  /// while untapped, a tap costs a single branch.
+  ///
+  /// Since the tap sends while owning the lock of this channel, out
+  /// must not be this channel, nor tap this channel in turn.
+  template<std::size_t M>
+  void tap(double sample_rate, channel<T, M> out)
+  {
+    tap(sample_rate, ochannel<T, M>(out));
+  }
+
+  template<std::size_t M>
+  void tap(double sample_rate, ochannel<T, M> out)
+  {
+    tap(sample_rate, out, [](const T& t) -> const T& { return t; });
+  }
+
+  /// Mirrors the projection of a sample of sent elements
+
+  /// Rather than a copy of a sampled element t, projection(t) is sent
+  /// to out; it is only called if out can take the element. Propagates
+  /// exceptions thrown by projection to the sender, in which case the
+  /// element is not sent.
+  template<class U, std::size_t M, class Projection>
+  void tap(double sample_rate, channel<U, M> out, Projection projection)
+  {
+    tap(sample_rate, ochannel<U, M>(out), projection);
+  }
+
+  template<class U, std::size_t M, class Projection>
+  void tap(double sample_rate, ochannel<U, M> out, Projection projection)
+  {
+    m_channel_ptr->tap(internal::make_unique<
+      internal::_sampling_tap<T, U, M, Projection>>(
+        sample_rate, out, projection));
+  }
+
+  void untap()
+  {
+    m_channel_ptr->tap(nullptr);
+  }
 };
 
 class select;
@@ -330,6 +1140,7 @@ class ichannel
 private:
   friend class select;
   friend class channel<T, N>;
+  friend struct internal::_access;
   std::shared_ptr<internal::_channel<T, N>> m_channel_ptr;
 
 public:
@@ -379,6 +1190,59 @@ public:
     return m_channel_ptr->recv_ptr();
   }
 
+  /// Receives into t if an element is available, and returns whether it was
+
+  /// Unlike a select, this neither allocates nor polls.
+  bool try_recv(T& t)
+  {
+    return m_channel_ptr->try_recv(t);
+  }
+
+  /// Receives into t unless no element arrives within timeout
+
+  /// Returns false, leaving t unchanged, if the timeout expired.
+  /// Propagates exceptions thrown by std::condition_variable::wait_until()
+  template<class Rep, class Period>
+  bool recv_for(T& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->recv_until(t, internal::_deadline(timeout));
+  }
+
+  /// Receives the first queued element that satisfies pred, if any
+
+  /// Scans at most max_depth elements from the front of the queue while
+  /// owning the channel's lock, so pred should be cheap and must not use
+  /// the channel. The match is removed wherever it is in the queue; all
+  /// other elements keep their order. Returns false, leaving t unchanged,
+  /// if no scanned element satisfies pred.
+  ///
+  /// Propagates exceptions thrown by pred
+  template<class Predicate>
+  bool try_recv_if(Predicate pred, T& t,
+    std::size_t max_depth = std::numeric_limits<std::size_t>::max())
+  {
+    return m_channel_ptr->try_recv_if(pred, t, max_depth);
+  }
+
+  /// Blocks until it has received an element that satisfies pred
+
+  /// Like try_recv_if(), but while no scanned element matches, waits for
+  /// the next enqueue and scans again. Elements that become scannable
+  /// because others dequeued elements ahead of them are only noticed on
+  /// the next enqueue.
+  ///
+  /// Unlike a blocked recv(), a blocked recv_if() does not let try_send()
+  /// or a send case of a select enqueue into an unbuffered channel, since
+  /// it might reject the element and leave the sender's handshake open.
+  ///
+  /// Propagates exceptions thrown by pred and by
+  /// std::condition_variable::wait()
+  template<class Predicate>
+  void recv_if(Predicate pred, T& t,
+    std::size_t max_depth = std::numeric_limits<std::size_t>::max())
+  {
+    m_channel_ptr->recv_if(pred, t, max_depth);
+  }
 };
 
 /// Can only be used to send elements of type T
@@ -388,6 +1252,7 @@ class ochannel
 private:
   friend class select;
   friend class channel<T, N>;
+  friend struct internal::_access;
   std::shared_ptr<internal::_channel<T, N>> m_channel_ptr;
 
 public:
@@ -427,8 +1292,107 @@ public:
   {
     m_channel_ptr->send(std::move(t));
   }
+
+  /// Sends t if that does not block, and returns whether it did
+
+  /// A buffered channel accepts t if its queue has room, an unbuffered
+  /// one only if a receiver is already waiting. Unlike a select, this
+  /// neither allocates nor polls.
+  bool try_send(const T& t)
+  {
+    return m_channel_ptr->try_send(t);
+  }
+
+  bool try_send(T&& t)
+  {
+    return m_channel_ptr->try_send(std::move(t));
+  }
+
+  /// Sends t unless that takes longer than timeout
+
+  /// Returns true once t has been enqueued and, like send(), the channel
+  /// is no longer full, i.e. t has been received by some thread if the
+  /// channel is unbuffered. Otherwise, returns false and t is withdrawn,
+  /// so that it will never be received, though a tap may have mirrored
+  /// it. Propagates exceptions thrown by
+  /// std::condition_variable::wait_until()
+  template<class Rep, class Period>
+  bool send_for(const T& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->send_until(t, internal::_deadline(timeout));
+  }
+
+  template<class Rep, class Period>
+  bool send_for(T&& t, const std::chrono::duration<Rep, Period>& timeout)
+  {
+    return m_channel_ptr->send_until(std::move(t),
+      internal::_deadline(timeout));
+  }
 };
 
+namespace internal
+{
+
+// Gives library components access to the channel shared by handles
+struct _access
+{
+  template<class T, std::size_t N>
+  static _channel<T, N>& get(const channel<T, N>& c) noexcept
+  {
+    return *c.m_channel_ptr;
+  }
+
+  template<class T, std::size_t N>
+  static _channel<T, N>& get(const ichannel<T, N>& c) noexcept
+  {
+    return *c.m_channel_ptr;
+  }
+
+  template<class T, std::size_t N>
+  static _channel<T, N>& get(const ochannel<T, N>& c) noexcept
+  {
+    return *c.m_channel_ptr;
+  }
+};
+
+// Deterministically sends every (1 / sample_rate)-th projection
+template<class T, class U, std::size_t M, class Projection>
+class _sampling_tap : public _tap<T>
+{
+private:
+  ochannel<U, M> m_out;
+  Projection m_projection;
+  const double m_sample_rate;
+
+  // guarded by lock of tapped channel
+  double m_credit;
+
+public:
+  _sampling_tap(double sample_rate, ochannel<U, M> out, Projection p)
+  : m_out(out),
+    m_projection(p),
+    m_sample_rate(sample_rate < 0 ? 0 : sample_rate > 1 ? 1 : sample_rate),
+    m_credit(0) {}
+
+  void mirror(const T& t) override
+  {
+    m_credit += m_sample_rate;
+    if (m_credit < 1)
+      return;
+
+    // Drops the element unless it can be sent without blocking; the
+    // sender never waits for out's lock, nor takes part in a select
+    // that receives from out.
+    m_credit -= 1;
+    _access::get(m_out).try_lock_send([this, &t]() -> U
+    {
+      return U(m_projection(t));
+    });
+  }
+};
+
+}
+
 /// Go's select statement
 
 /// \see http://golang.org/ref/spec#Select_statements
@@ -448,26 +1412,57 @@ private:
     {
       internal::_channel<V, N>& _c = *c.m_channel_ptr;
       std::unique_lock<std::mutex> lock(_c.mutex(), std::defer_lock);
-      if (lock.try_lock() && _c.try_send(lock, std::forward<U>(u)))
+      if (!lock.try_lock())
+        return false;
+
+      // queue depth at the time the case is tried
+      const std::size_t depth = _c.depth();
+      CPP_CHANNEL_PROBE(select_try, &_c, depth, sizeof(V));
+      if (_c.try_send(lock, std::forward<U>(u)))
+      {
+        assert(!lock.owns_lock());
+        CPP_CHANNEL_PROBE(select_win, &_c, depth, sizeof(V));
+        f();
+        return true;
+      }
+
+      return false;
+    }
+
+  public:
+    bool operator()(ochannel<T, N>& c, const T& t, NullaryFunction f)
+    {
+      return _run(c, t, f); 
+    }
+
+    bool operator()(ochannel<T, N>& c, T&& t, NullaryFunction f)
+    {
+      return _run(c, std::move(t), f); 
+    }
+  };
+
+  template<class T, std::size_t N, class Factory, class NullaryFunction>
+  struct try_send_lazy_nullary
+  {
+    bool operator()(ochannel<T, N>& c, Factory& make, NullaryFunction f)
+    {
+      internal::_channel<T, N>& _c = *c.m_channel_ptr;
+      std::unique_lock<std::mutex> lock(_c.mutex(), std::defer_lock);
+      if (!lock.try_lock())
+        return false;
+
+      const std::size_t depth = _c.depth();
+      CPP_CHANNEL_PROBE(select_try, &_c, depth, sizeof(T));
+      if (_c.try_send_lazy(lock, make))
       {
         assert(!lock.owns_lock());
+        CPP_CHANNEL_PROBE(select_win, &_c, depth, sizeof(T));
         f();
         return true;
       }
 
       return false;
     }
-
-  public:
-    bool operator()(ochannel<T, N>& c, const T& t, NullaryFunction f)
-    {
-      return _run(c, t, f); 
-    }
-
-    bool operator()(ochannel<T, N>& c, T&& t, NullaryFunction f)
-    {
-      return _run(c, std::move(t), f); 
-    }
   };
 
   template<class T, std::size_t N, class NullaryFunction>
@@ -479,10 +1474,13 @@ private:
       std::unique_lock<std::mutex> lock(_c.mutex(), std::defer_lock);
       if (lock.try_lock())
       {
+        const std::size_t depth = _c.depth();
+        CPP_CHANNEL_PROBE(select_try, &_c, depth, sizeof(T));
         std::pair<bool, std::unique_ptr<T>> pair = _c.try_recv_ptr(lock);
         if (pair.first)
         {
           assert(!lock.owns_lock());
+          CPP_CHANNEL_PROBE(select_win, &_c, depth, sizeof(T));
           t = *pair.second;
           f();
           return true;
@@ -502,10 +1500,13 @@ private:
       std::unique_lock<std::mutex> lock(_c.mutex(), std::defer_lock);
       if (lock.try_lock())
       {
+        const std::size_t depth = _c.depth();
+        CPP_CHANNEL_PROBE(select_try, &_c, depth, sizeof(T));
         std::pair<bool, std::unique_ptr<T>> pair = _c.try_recv_ptr(lock);
         if (pair.first)
         {
           assert(!lock.owns_lock());
+          CPP_CHANNEL_PROBE(select_win, &_c, depth, sizeof(T));
           f(std::move(*pair.second));
           return true;
         }
@@ -558,6 +1559,29 @@ public:
     return *this;
   }
 
+  /// Send case whose element is only made if the channel accepts it
+
+  /// Unlike send(c, t, f), the element is not constructed, let alone
+  /// copied, when the select is set up. Instead, make() is invoked while
+  /// the case is tried and the channel is known to accept an element,
+  /// and its result is moved into the channel's queue. So make() runs at
+  /// most once per select, and not at all if another case succeeds.
+  /// Exceptions thrown by make() propagate out of try_once() or wait(),
+  /// and leave the channel unchanged.
+  template<class T, std::size_t N, class Factory, class NullaryFunction>
+  select& send_lazy(channel<T, N> c, Factory make, NullaryFunction f)
+  {
+    return send_lazy(ochannel<T, N>(c), make, f);
+  }
+
+  template<class T, std::size_t N, class Factory, class NullaryFunction>
+  select& send_lazy(ochannel<T, N> c, Factory make, NullaryFunction f)
+  {
+    m_try_functions.push_back(std::bind(
+      try_send_lazy_nullary<T, N, Factory, NullaryFunction>(), c, make, f));
+    return *this;
+  }
+
   /* receive cases */
 
   template<class T, std::size_t N>
@@ -605,17 +1629,25 @@ public:
   /// Returns true if and only if exactly one case succeeded
   bool try_once()
   {
+    internal::_hook(internal::_event::select_begin, this);
     const try_functions::size_type n = m_try_functions.size(), i = random_gen();
     for(try_functions::size_type j = 0; j < n; j++)
     {
       if (m_try_functions.at((i + j) % n)())
+      {
+        internal::_hook(internal::_event::select_end, this);
         return true;
+      }
     }
+    internal::_hook(internal::_event::select_end, this);
     return false;
   }
 
   void wait()
   {
+    internal::_hook(internal::_event::select_begin, this);
+    internal::_blocked_scope blocked(this, nullptr,
+      internal::_blocked_op::select);
     const try_functions::size_type n = m_try_functions.size();
     try_functions::size_type i = random_gen();
     for(;;)
@@ -624,12 +1656,16 @@ public:
       if (m_try_functions.at(i)())
         break;
     }
+    internal::_hook(internal::_event::select_end, this);
   }
 
   // Propagates any exception thrown by std::this_thread::sleep_for
   template<class Rep, class Period>
   void wait(const std::chrono::duration<Rep, Period>& sleep)
   {
+    internal::_hook(internal::_event::select_begin, this);
+    internal::_blocked_scope blocked(this, nullptr,
+      internal::_blocked_op::select);
     const try_functions::size_type n = m_try_functions.size();
     try_functions::size_type i = random_gen();
     for(;;)
@@ -640,9 +1676,163 @@ public:
 
       std::this_thread::sleep_for(sleep);
     }
+    internal::_hook(internal::_event::select_end, this);
   }
 };
 
+namespace internal
+{
+
+// Uniformly distributed in [0, n) for n > 0, so that no channel of a
+// select_any() is preferred over the others
+inline std::size_t _random_index(std::size_t n)
+{
+  thread_local std::minstd_rand random_gen(std::hash<std::thread::id>()(
+    std::this_thread::get_id()));
+  return random_gen() % n;
+}
+
+// Receives from the first nonempty channel, starting at a random one
+template<class Channel, class T>
+std::size_t _try_select_any(const std::vector<Channel>& channels, T& t)
+{
+  const std::size_t n = channels.size();
+  if (n == 0)
+    return n;
+
+  const std::size_t start = _random_index(n);
+  for (std::size_t j = 0; j < n; j++)
+  {
+    const std::size_t i = start + j < n ? start + j : start + j - n;
+    if (_access::get(channels[i]).try_recv(t))
+      return i;
+  }
+  return n;
+}
+
+template<class Channel, class T>
+std::size_t _select_any(const std::vector<Channel>& channels, T& t,
+  const std::chrono::steady_clock::time_point* deadline)
+{
+  _hook(_event::select_begin, &channels);
+  const std::size_t n = channels.size();
+  std::size_t i = _try_select_any(channels, t);
+  if (i == n && n != 0)
+  {
+    // stay parked across retries so that every enqueue either notifies
+    // this waiter or, if it has been notified already, another one
+    _waiter waiter;
+    _waiter_nodes nodes(n, waiter);
+
+    // an element enqueued before parking would not notify the waiter
+    bool is_ready = false;
+    for (std::size_t j = 0; j < n; j++)
+      is_ready = _access::get(channels[j]).park(nodes[j]) || is_ready;
+
+    for (;;)
+    {
+      bool is_timeout = false;
+      {
+        std::unique_lock<std::mutex> lock(waiter.mutex);
+        if (!is_ready && !waiter.is_notified)
+        {
+          _blocked_scope blocked(&_access::get(channels[0]), nullptr,
+            _blocked_op::select);
+          const auto is_notified = [&waiter]{ return waiter.is_notified; };
+          if (deadline == nullptr)
+            waiter.cv.wait(lock, is_notified);
+          else
+            is_timeout = !waiter.cv.wait_until(lock, *deadline, is_notified);
+        }
+
+        // reset before trying so that a later enqueue is not missed
+        waiter.is_notified = false;
+      }
+
+      // try once more after the deadline to not miss a late element
+      is_ready = false;
+      i = _try_select_any(channels, t);
+      if (i != n || is_timeout)
+        break;
+    }
+
+    // since notify() runs under the channel's lock, no channel touches
+    // the waiter after it has been unparked; unparking hands an element
+    // that this waiter was notified of but left to another waiter
+    for (std::size_t j = 0; j < n; j++)
+      _access::get(channels[j]).unpark(nodes[j]);
+  }
+  _hook(_event::select_end, &channels);
+  return i;
+}
+
+}
+
+/// Receives from whichever of the channels has an element
+
+/// Returns the index of the channel that t was received from, or
+/// channels.size() if all channels were empty. Unlike a select, the
+/// channels are tried without type erasure or allocation, starting at
+/// a random one so that none of them is starved.
+///
+/// Like try_recv(), a select_any() does not count as a waiting receiver
+/// of an unbuffered channel. So the sender must use send(), not a select
+/// or try_send().
+template<class T, std::size_t N>
+std::size_t try_select_any(const std::vector<ichannel<T, N>>& channels,
+  T& t)
+{
+  return internal::_try_select_any(channels, t);
+}
+
+template<class T, std::size_t N>
+std::size_t try_select_any(const std::vector<channel<T, N>>& channels,
+  T& t)
+{
+  return internal::_try_select_any(channels, t);
+}
+
+/// Blocks until it has received from one of the channels
+
+/// Returns the index of the channel that t was received from, see also
+/// try_select_any(). While all channels are empty, the calling thread
+/// sleeps until the next element is enqueued on any of them, instead of
+/// polling. Returns 0 at once if channels is empty.
+///
+/// Propagates exceptions thrown by std::condition_variable::wait()
+template<class T, std::size_t N>
+std::size_t select_any(const std::vector<ichannel<T, N>>& channels, T& t)
+{
+  return internal::_select_any(channels, t, nullptr);
+}
+
+template<class T, std::size_t N>
+std::size_t select_any(const std::vector<channel<T, N>>& channels, T& t)
+{
+  return internal::_select_any(channels, t, nullptr);
+}
+
+/// Like select_any(), but returns channels.size() after timeout
+
+/// Propagates exceptions thrown by std::condition_variable::wait_until()
+template<class T, std::size_t N, class Rep, class Period>
+std::size_t select_any_for(const std::vector<ichannel<T, N>>& channels,
+  T& t, const std::chrono::duration<Rep, Period>& timeout)
+{
+  const std::chrono::steady_clock::time_point deadline =
+    internal::_deadline(timeout);
+  return internal::_select_any(channels, t, &deadline);
+}
+
+template<class T, std::size_t N, class Rep, class Period>
+std::size_t select_any_for(const std::vector<channel<T, N>>& channels,
+  T& t, const std::chrono::duration<Rep, Period>& timeout)
+{
+  const std::chrono::steady_clock::time_point deadline =
+    internal::_deadline(timeout);
+  return internal::_select_any(channels, t, &deadline);
+}
+
 template<class T, std::size_t N>
 bool channel<T, N>::operator==(const ichannel<T, N>& other) const noexcept
 {
@@ -668,17 +1858,12 @@ bool channel<T, N>::operator!=(const ochannel<T, N>& other) const noexcept
 }
 
 template<class T, std::size_t N>
-template<class U>
-bool internal::_channel<T, N>::try_send(
-  std::unique_lock<std::mutex>& lock, U&& u)
+template<class Factory>
+bool internal::_channel<T, N>::_try_send_lazy(
+  std::unique_lock<std::mutex>& lock, Factory&& make)
 {
-  m_is_try_send_ready = true;
-
-  // TODO: support the case where both ends of a channel are inside a select
-  assert(!is_try_ready());
-
   if ((!m_is_send_done || !m_is_try_send_done || is_full() ||
-       (0 == N - m_queue.size() && !m_is_recv_ready)))
+       (0 == N - m_queue.size() && m_recv_ready == 0)))
   {
     // TODO: investigate potential LLVM libc++ RAII unlocking issue
     lock.unlock();
@@ -690,25 +1875,85 @@ bool internal::_channel<T, N>::try_send(
   assert(!is_full());
 
   // if enqueue should block, there must be a receiver waiting
-  m_is_try_send_done = 0 < N - m_queue.size();
-  assert(m_is_try_send_done || m_is_recv_ready);
+  const bool is_try_send_done = 0 < N - m_queue.size();
+  assert(is_try_send_done || 0 < m_recv_ready);
 
-  m_queue.emplace_back(std::this_thread::get_id(), std::forward<U>(u));
+  // make() is evaluated before the queue and the flags change
+  _enqueue(make());
+  m_is_try_send_done = is_try_send_done;
 
   // Let v be the value enqueued by try_send(). If m_is_try_send_done
   // is false, no other sender (whether blocking or not) can enqueue a
   // value until a receiver has dequeued v, thereby ensuring the channel
   // FIFO order when the queue is filled up by try_send(). Moreover, in
-  // that case, since m_is_try_send_done implies m_is_recv_ready, such a
+  // that case, since !m_is_try_send_done implies m_recv_ready > 0, such a
   // receiver is guaranteed to exist, and it will reset m_is_try_send_done
   // to true so that other senders can make progress after v has been
   // dequeued. And by notifying m_recv_cv, other receivers waiting for
   // the queue to become nonempty can make progress as well.
-  lock.unlock();
-  m_recv_cv.notify_one();
+  _notify(m_recv_cv, m_recv_waiters, lock);
   return true;
 }
 
+template<class T, std::size_t N>
+template<class U>
+bool internal::_channel<T, N>::try_send(
+  std::unique_lock<std::mutex>& lock, U&& u)
+{
+  m_is_try_send_ready = true;
+
+  // TODO: support the case where both ends of a channel are inside a select
+  assert(!is_try_ready());
+
+  return _try_send(lock, std::forward<U>(u));
+}
+
+template<class T, std::size_t N>
+template<class Factory>
+bool internal::_channel<T, N>::try_send_lazy(
+  std::unique_lock<std::mutex>& lock, Factory&& make)
+{
+  m_is_try_send_ready = true;
+
+  // TODO: support the case where both ends of a channel are inside a select
+  assert(!is_try_ready());
+
+  return _try_send_lazy(lock, std::forward<Factory>(make));
+}
+
+template<class T, std::size_t N>
+void internal::_channel<T, N>::_post_try_recv(
+  std::unique_lock<std::mutex>& lock, std::size_t i)
+{
+  // Out of FIFO order, the element still counts as the next dequeued
+  // one, so a trace may pair up enqueues and dequeues out of order
+  if (i == 0)
+    m_queue.pop_front();
+  else
+    m_queue.erase(m_queue.begin() + i);
+  assert(!is_full());
+  _hook(_event::dequeue, this, _next_dequeued(), sizeof(T));
+  CPP_CHANNEL_PROBE(dequeue, this, m_queue.size(), sizeof(T));
+  m_parties.last_receiver.store(std::this_thread::get_id(),
+    std::memory_order_relaxed);
+
+  // protocol with nonblocking calls
+  m_is_try_send_done = true;
+  m_is_try_recv_ready = false;
+  m_is_try_send_ready = false;
+
+  // see also explanation in _channel::_post_blocking_recv()
+  if (m_is_send_done)
+  {
+    _notify(m_send_begin_cv, m_send_waiters, lock);
+  }
+  else
+  {
+    lock.unlock();
+    m_send_end_cv.notify_one();
+  }
+}
+
 template<class T, std::size_t N>
 std::pair<bool, std::unique_ptr<T>> internal::_channel<T, N>::try_recv_ptr(
   std::unique_lock<std::mutex>& lock)
@@ -735,41 +1980,109 @@ std::pair<bool, std::unique_ptr<T>> internal::_channel<T, N>::try_recv_ptr(
   // move/copy before pop_front() to ensure strong exception safety
   std::unique_ptr<T> t_ptr(make_unique<T>(std::move(pair.second)));
 
-  m_queue.pop_front();
-  assert(!is_full());
+  _post_try_recv(lock);
+  return std::make_pair(true, std::move(t_ptr));
+}
 
-  // protocol with nonblocking calls
-  m_is_try_send_done = true;
-  m_is_try_recv_ready = false;
-  m_is_try_send_ready = false;
+template<class T, std::size_t N>
+bool internal::_channel<T, N>::try_recv(T& t)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_queue.empty())
+    return false;
 
-  // see also explanation in _channel::_post_blocking_recv()
-  if (m_is_send_done)
-  {
-    lock.unlock();
-    m_send_begin_cv.notify_one();
-  }
-  else
+  _recv_at(lock, 0, t);
+  return true;
+}
+
+template<class T, std::size_t N>
+template<class Predicate>
+bool internal::_channel<T, N>::try_recv_if(Predicate pred, T& t,
+  std::size_t max_depth)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const std::size_t i = _find_if(pred, max_depth);
+  if (i == m_queue.size())
+    return false;
+
+  _recv_at(lock, i, t);
+  return true;
+}
+
+template<class T, std::size_t N>
+template<class Predicate>
+void internal::_channel<T, N>::recv_if(Predicate pred, T& t,
+  std::size_t max_depth)
+{
+  _hook(_event::recv_begin, this);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  std::size_t i = _find_if(pred, max_depth);
+  if (i == m_queue.size())
   {
-    lock.unlock();
-    m_send_end_cv.notify_one();
+    // Unlike m_recv_cv, whose notifications are meant for any receiver,
+    // a parked waiter is notified of every enqueue. So it cannot swallow
+    // the wake-up of a receiver that would have accepted the element.
+    _waiter waiter;
+    _waiter_node node{&waiter, m_waiters, true};
+    m_waiters = &node;
+
+    try
+    {
+      _hook(_event::recv_block, this);
+      CPP_CHANNEL_PROBE(recv_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::recv);
+      do
+      {
+        lock.unlock();
+        {
+          std::unique_lock<std::mutex> waiter_lock(waiter.mutex);
+          waiter.cv.wait(waiter_lock, [&waiter]{ return waiter.is_notified; });
+          waiter.is_notified = false;
+        }
+        lock.lock();
+        i = _find_if(pred, max_depth);
+      }
+      while (i == m_queue.size());
+      CPP_CHANNEL_PROBE(recv_wake, this, m_queue.size(), sizeof(T));
+    }
+    catch (...)
+    {
+      if (!lock.owns_lock())
+        lock.lock();
+
+      _unlink(node);
+      throw;
+    }
+
+    // no enqueue can notify the waiter once it is unlinked
+    _unlink(node);
   }
 
-  return std::make_pair(true, std::move(t_ptr));
+  _recv_at(lock, i, t);
+  _hook(_event::recv_end, this);
 }
 
 template<class T, std::size_t N>
 template<class U>
 void internal::_channel<T, N>::_send(U&& u)
 {
+  _hook(_event::send_begin, this);
+
   // unlock before notifying threads; otherwise, the
   // notified thread would unnecessarily block again
   {
     // wait (if necessary) until queue is no longer full and any
     // previous _send() has successfully enqueued element
     std::unique_lock<std::mutex> lock(m_mutex);
-    m_send_begin_cv.wait(lock, [this]{ return m_is_send_done &&
-      m_is_try_send_done && !is_full(); });
+    if (!(m_is_send_done && m_is_try_send_done && !is_full()))
+    {
+      _hook(_event::send_block, this);
+      CPP_CHANNEL_PROBE(send_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::send);
+      _wait(m_send_begin_cv, m_send_waiters, lock, [this]{
+        return m_is_send_done && m_is_try_send_done && !is_full(); });
+      CPP_CHANNEL_PROBE(send_wake, this, m_queue.size(), sizeof(T));
+    }
 
     assert(m_is_send_done);
     assert(m_is_try_send_done);
@@ -778,12 +2091,12 @@ void internal::_channel<T, N>::_send(U&& u)
     // TODO: support the case where both ends of a channel are inside a select
     assert(!is_try_ready());
 
-    m_queue.emplace_back(std::this_thread::get_id(), std::forward<U>(u));
+    _enqueue(std::forward<U>(u));
     m_is_send_done = false;
-  }
 
-  // nonblocking
-  m_recv_cv.notify_one();
+    // nonblocking
+    _notify(m_recv_cv, m_recv_waiters, lock);
+  }
 
   // wait (if necessary) until u has been received by another thread
   {
@@ -794,12 +2107,85 @@ void internal::_channel<T, N>::_send(U&& u)
     // during the brief time we didn't own the lock.
     //
     // Performance note: unblocks after at least N successful recv calls
-    m_send_end_cv.wait(lock, [this]{ return !is_full(); });
+    if (is_full())
+    {
+      _hook(_event::send_block, this);
+      CPP_CHANNEL_PROBE(send_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::send);
+      m_send_end_cv.wait(lock, [this]{ return !is_full(); });
+      CPP_CHANNEL_PROBE(send_wake, this, m_queue.size(), sizeof(T));
+    }
+    m_is_send_done = true;
+
+    // see also explanation in _channel<T, N>::recv()
+    _notify(m_send_begin_cv, m_send_waiters, lock);
+  }
+
+  _hook(_event::send_end, this);
+}
+
+// Same protocol as _send(), except that both waits give up at deadline
+template<class T, std::size_t N>
+template<class U>
+bool internal::_channel<T, N>::_send_until(U&& u,
+  std::chrono::steady_clock::time_point deadline)
+{
+  _hook(_event::send_begin, this);
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!(m_is_send_done && m_is_try_send_done && !is_full()))
+    {
+      _hook(_event::send_block, this);
+      CPP_CHANNEL_PROBE(send_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::send);
+      const bool is_ready = _wait_until(m_send_begin_cv, m_send_waiters,
+        lock, deadline, [this]{
+          return m_is_send_done && m_is_try_send_done && !is_full(); });
+      CPP_CHANNEL_PROBE(send_wake, this, m_queue.size(), sizeof(T));
+
+      if (!is_ready)
+      {
+        lock.unlock();
+        _hook(_event::send_end, this);
+        return false;
+      }
+    }
+
+    // TODO: support the case where both ends of a channel are inside a select
+    assert(!is_try_ready());
+
+    _enqueue(std::forward<U>(u));
+    m_is_send_done = false;
+    _notify(m_recv_cv, m_recv_waiters, lock);
+  }
+
+  bool is_received = true;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (is_full())
+    {
+      _hook(_event::send_block, this);
+      CPP_CHANNEL_PROBE(send_block, this, m_queue.size(), sizeof(T));
+      _blocked_scope blocked(this, &m_parties, _blocked_op::send);
+      is_received = m_send_end_cv.wait_until(lock, deadline,
+        [this]{ return !is_full(); });
+      CPP_CHANNEL_PROBE(send_wake, this, m_queue.size(), sizeof(T));
+    }
+
+    if (!is_received)
+    {
+      // Since m_is_send_done == false, no other thread has enqueued an
+      // element after u, and since the queue is still full, u has not
+      // been dequeued either. So u is withdrawn from the back.
+      _withdraw_back();
+    }
     m_is_send_done = true;
+    _notify(m_send_begin_cv, m_send_waiters, lock);
   }
 
-  // see also explanation in _channel<T, N>::recv()
-  m_send_begin_cv.notify_one();
+  _hook(_event::send_end, this);
+  return is_received;
 }
 
 template<class T, std::size_t N>
@@ -808,6 +2194,7 @@ T internal::_channel<T, N>::recv()
   static_assert(internal::_is_exception_safe<T>::value,
     "Cannot guarantee exception safety, use another recv operator");
 
+  _hook(_event::recv_begin, this);
   std::unique_lock<std::mutex> lock(m_mutex);
   _pre_blocking_recv(lock);
 
@@ -815,12 +2202,14 @@ T internal::_channel<T, N>::recv()
   assert(!is_full() || std::this_thread::get_id() != pair.first);
 
   _post_blocking_recv(lock);
+  _hook(_event::recv_end, this);
   return std::move(pair.second);
 }
 
 template<class T, std::size_t N>
 void internal::_channel<T, N>::recv(T& t)
 {
+  _hook(_event::recv_begin, this);
   std::unique_lock<std::mutex> lock(m_mutex);
   _pre_blocking_recv(lock);
 
@@ -830,11 +2219,45 @@ void internal::_channel<T, N>::recv(T& t)
   // assignment before pop_front() to ensure strong exception safety
   t = std::move(pair.second);
   _post_blocking_recv(lock);
+  _hook(_event::recv_end, this);
+}
+
+template<class T, std::size_t N>
+std::size_t internal::_channel<T, N>::recv_n(std::vector<T>& v,
+  std::size_t k)
+{
+  _hook(_event::recv_begin, this);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  _pre_blocking_recv(lock);
+
+  std::size_t i = 0;
+  try
+  {
+    for (; i < k && !m_queue.empty(); i++)
+    {
+      assert(!is_full() ||
+        std::this_thread::get_id() != m_queue.front().first);
+
+      // an element whose move throws stays in the queue
+      v.push_back(std::move(m_queue.front().second));
+      _pop_front();
+    }
+  }
+  catch (...)
+  {
+    _notify_sender(lock);
+    throw;
+  }
+
+  _notify_sender(lock);
+  _hook(_event::recv_end, this);
+  return i;
 }
 
 template<class T, std::size_t N>
 std::unique_ptr<T> internal::_channel<T, N>::recv_ptr()
 {
+  _hook(_event::recv_begin, this);
   std::unique_lock<std::mutex> lock(m_mutex);
   _pre_blocking_recv(lock);
 
@@ -844,9 +2267,54 @@ std::unique_ptr<T> internal::_channel<T, N>::recv_ptr()
   // move/copy before pop_front() to ensure strong exception safety
   std::unique_ptr<T> t_ptr(make_unique<T>(std::move(pair.second)));
   _post_blocking_recv(lock);
+  _hook(_event::recv_end, this);
   return t_ptr;
 }
 
+template<class T, std::size_t N>
+bool internal::_channel<T, N>::recv_until(T& t,
+  std::chrono::steady_clock::time_point deadline)
+{
+  _hook(_event::recv_begin, this);
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  // see also _pre_blocking_recv()
+  if (m_queue.empty())
+  {
+    _hook(_event::recv_block, this);
+    CPP_CHANNEL_PROBE(recv_block, this, m_queue.size(), sizeof(T));
+    _blocked_scope blocked(this, &m_parties, _blocked_op::recv);
+    bool is_ready;
+    {
+      // once it times out, an unbuffered try_send() must no longer count
+      // on this receiver, but still on any other one that is waiting
+      _recv_ready_scope ready(m_recv_ready);
+      is_ready = _wait_until(m_recv_cv, m_recv_waiters, lock, deadline,
+        [this]{ return !m_queue.empty(); });
+    }
+    CPP_CHANNEL_PROBE(recv_wake, this, m_queue.size(), sizeof(T));
+
+    if (!is_ready)
+    {
+      lock.unlock();
+      _hook(_event::recv_end, this);
+      return false;
+    }
+  }
+
+  // TODO: support the case where both ends of a channel are inside a select
+  assert(!is_try_ready());
+
+  std::pair<std::thread::id, T> pair(std::move(m_queue.front()));
+  assert(!is_full() || std::this_thread::get_id() != pair.first);
+
+  // assignment before pop_front() to ensure strong exception safety
+  t = std::move(pair.second);
+  _post_blocking_recv(lock);
+  _hook(_event::recv_end, this);
+  return true;
+}
+
 }
 
 #endif
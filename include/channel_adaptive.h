@@ -0,0 +1,469 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_ADAPTIVE_H
+#define CPP_CHANNEL_ADAPTIVE_H
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <type_traits>
+#include <condition_variable>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+/// Senders and receivers that an adaptive_channel has observed so far
+enum class adaptive_mode : unsigned char
+{
+  /// at most one sender thread and one receiver thread
+  spsc = 0,
+
+  /// several sender threads
+  mpsc = 1,
+
+  /// several receiver threads
+  spmc = 2,
+
+  mpmc = 3
+};
+
+namespace internal
+{
+
+template<class T, std::size_t N>
+class _adaptive_channel
+{
+static_assert(N > 0, "adaptive channels must be buffered");
+
+private:
+  // engines, in the order in which the channel goes through them
+  enum : unsigned
+  {
+    _ring,
+    _upgrading,
+    _locking
+  };
+
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type _slot;
+
+  // Atomics that the producer and the consumer write are kept apart,
+  // so that they do not share a cache line
+  struct _padded_index
+  {
+    std::atomic<std::size_t> value;
+    char padding[64];
+
+    _padded_index()
+    : value(0) {}
+  };
+
+  struct _padded_flag
+  {
+    std::atomic<bool> value;
+    char padding[64];
+
+    _padded_flag()
+    : value(false) {}
+  };
+
+  // Bounded ring of the SPSC engine. The consumer owns m_head and the
+  // producer owns m_tail; both only ever grow.
+  std::unique_ptr<_slot[]> m_ring;
+  _padded_index m_head;
+  _padded_index m_tail;
+
+  // set while an owner accesses the ring, so that an upgrade can wait
+  // until neither does
+  _padded_flag m_is_producer_busy;
+  _padded_flag m_is_consumer_busy;
+
+  std::atomic<unsigned> m_engine;
+
+  // first sender and receiver thread, respectively
+  std::atomic<std::thread::id> m_producer;
+  std::atomic<std::thread::id> m_consumer;
+
+  // adaptive_mode bits
+  std::atomic<unsigned> m_mode;
+
+  // An owner that finds the ring full or empty sleeps on m_park_cv
+  std::atomic<unsigned> m_sleepers;
+  std::mutex m_park_mutex;
+  std::condition_variable m_park_cv;
+
+  // held for the whole upgrade
+  std::mutex m_upgrade_mutex;
+
+  // null until upgraded, published by m_engine
+  std::unique_ptr<_channel<T, N>> m_locking;
+
+  T& _at(std::size_t i)
+  {
+    return *reinterpret_cast<T*>(&m_ring[i % N]);
+  }
+
+  // Is the calling thread the first one on its side of the channel?
+  // Otherwise, records that there are several threads on that side.
+  bool _is_owner(std::atomic<std::thread::id>& owner, adaptive_mode bit)
+  {
+    const std::thread::id self = std::this_thread::get_id();
+    std::thread::id id = owner.load(std::memory_order_relaxed);
+    if (id == self)
+      return true;
+
+    // on failure, id is the owner
+    if (id == std::thread::id() && owner.compare_exchange_strong(id, self))
+      return true;
+
+    if (id == self)
+      return true;
+
+    const unsigned b = static_cast<unsigned>(bit);
+    if ((m_mode.load(std::memory_order_relaxed) & b) == 0)
+      m_mode.fetch_or(b, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Blocks until is_ready() or the end of the ring engine
+  template<class Predicate>
+  void _park(Predicate is_ready)
+  {
+    // most waits are short
+    for (unsigned i = 0; i < 64; i++)
+    {
+      if (is_ready())
+        return;
+
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(m_park_mutex);
+    m_sleepers.fetch_add(1);
+
+    // pairs with the fence in _wake()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_park_cv.wait(lock, is_ready);
+    m_sleepers.fetch_sub(1);
+  }
+
+  // Wakes the other owner, if it sleeps
+  void _wake()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) == 0)
+      return;
+
+    // under the lock, so that the notification cannot slip in between
+    // the sleeper's check of is_ready() and its wait
+    std::lock_guard<std::mutex> lock(m_park_mutex);
+    m_park_cv.notify_all();
+  }
+
+  // Ensures that the locking engine is in use
+  void _upgrade()
+  {
+    if (m_engine.load(std::memory_order_acquire) == _locking)
+      return;
+
+    std::lock_guard<std::mutex> lock(m_upgrade_mutex);
+    if (m_engine.load(std::memory_order_acquire) == _locking)
+      return;
+
+    // From now on, the owners stay away from the ring. An owner that is
+    // in the middle of an access finishes it first.
+    m_engine.store(_upgrading);
+    while (m_is_producer_busy.value.load() || m_is_consumer_busy.value.load())
+      std::this_thread::yield();
+
+    // The ring holds at most N elements. So no send blocks, and the
+    // elements keep their FIFO order.
+    std::unique_ptr<_channel<T, N>> locking(make_unique<_channel<T, N>>());
+    const std::size_t tail = m_tail.value.load(std::memory_order_relaxed);
+    for (std::size_t head = m_head.value.load(std::memory_order_relaxed);
+         head != tail; head++)
+    {
+      locking->send(std::move(_at(head)));
+      _at(head).~T();
+    }
+    m_head.value.store(tail, std::memory_order_relaxed);
+
+    m_locking = std::move(locking);
+    m_engine.store(_locking, std::memory_order_release);
+
+    // parked owners continue on the locking engine
+    std::lock_guard<std::mutex> park_lock(m_park_mutex);
+    m_park_cv.notify_all();
+  }
+
+  // Passes the front of the ring to assign and pops it, or returns
+  // false if the calling thread must use the locking engine
+  template<class Assign>
+  bool _ring_recv(Assign assign)
+  {
+    for (;;)
+    {
+      m_is_consumer_busy.value.store(true);
+      if (m_engine.load() != _ring)
+      {
+        m_is_consumer_busy.value.store(false);
+        return false;
+      }
+
+      const std::size_t head = m_head.value.load(std::memory_order_relaxed);
+      if (m_tail.value.load(std::memory_order_acquire) != head)
+      {
+        try
+        {
+          assign(_at(head));
+        }
+        catch (...)
+        {
+          m_is_consumer_busy.value.store(false);
+          throw;
+        }
+        _at(head).~T();
+        m_head.value.store(head + 1, std::memory_order_release);
+        m_is_consumer_busy.value.store(false, std::memory_order_release);
+        _wake();
+        return true;
+      }
+
+      m_is_consumer_busy.value.store(false);
+      _park([this, head]{
+        return m_tail.value.load() != head || m_engine.load() != _ring; });
+    }
+  }
+
+public:
+  _adaptive_channel(const _adaptive_channel&) = delete;
+
+  // Propagates exceptions thrown by std::condition_variable constructor
+  _adaptive_channel()
+  : m_ring(new _slot[N]),
+    m_head(),
+    m_tail(),
+    m_is_producer_busy(),
+    m_is_consumer_busy(),
+    m_engine(_ring),
+    m_producer(std::thread::id()),
+    m_consumer(std::thread::id()),
+    m_mode(static_cast<unsigned>(adaptive_mode::spsc)),
+    m_sleepers(0),
+    m_park_mutex(),
+    m_park_cv(),
+    m_upgrade_mutex(),
+    m_locking() {}
+
+  ~_adaptive_channel()
+  {
+    if (m_engine.load(std::memory_order_acquire) == _locking)
+      return;
+
+    const std::size_t tail = m_tail.value.load(std::memory_order_relaxed);
+    for (std::size_t head = m_head.value.load(std::memory_order_relaxed);
+         head != tail; head++)
+      _at(head).~T();
+  }
+
+  adaptive_mode mode() const
+  {
+    return static_cast<adaptive_mode>(m_mode.load(std::memory_order_relaxed));
+  }
+
+  bool is_upgraded() const
+  {
+    return m_engine.load(std::memory_order_acquire) == _locking;
+  }
+
+  template<class U>
+  void send(U&& u)
+  {
+    if (_is_owner(m_producer, adaptive_mode::mpsc) &&
+        m_engine.load(std::memory_order_acquire) == _ring)
+    {
+      for (;;)
+      {
+        m_is_producer_busy.value.store(true);
+        if (m_engine.load() != _ring)
+        {
+          m_is_producer_busy.value.store(false);
+          break;
+        }
+
+        const std::size_t tail = m_tail.value.load(std::memory_order_relaxed);
+        if (tail - m_head.value.load(std::memory_order_acquire) < N)
+        {
+          try
+          {
+            new (&m_ring[tail % N]) T(std::forward<U>(u));
+          }
+          catch (...)
+          {
+            m_is_producer_busy.value.store(false);
+            throw;
+          }
+          m_tail.value.store(tail + 1, std::memory_order_release);
+          m_is_producer_busy.value.store(false, std::memory_order_release);
+          _wake();
+          return;
+        }
+
+        m_is_producer_busy.value.store(false);
+        _park([this, tail]{ return tail - m_head.value.load() < N ||
+          m_engine.load() != _ring; });
+      }
+    }
+
+    _upgrade();
+    m_locking->send(std::forward<U>(u));
+  }
+
+  T recv()
+  {
+    if (_is_owner(m_consumer, adaptive_mode::spmc) &&
+        m_engine.load(std::memory_order_acquire) == _ring)
+    {
+      _slot front;
+      if (_ring_recv([&front](T& t) { new (&front) T(std::move(t)); }))
+      {
+        T& f = *reinterpret_cast<T*>(&front);
+        T t(std::move(f));
+        f.~T();
+        return t;
+      }
+    }
+
+    _upgrade();
+    return m_locking->recv();
+  }
+
+  void recv(T& t)
+  {
+    if (_is_owner(m_consumer, adaptive_mode::spmc) &&
+        m_engine.load(std::memory_order_acquire) == _ring &&
+        _ring_recv([&t](T& front) { t = std::move(front); }))
+      return;
+
+    _upgrade();
+    m_locking->recv(t);
+  }
+
+  std::unique_ptr<T> recv_ptr()
+  {
+    std::unique_ptr<T> t_ptr;
+    if (_is_owner(m_consumer, adaptive_mode::spmc) &&
+        m_engine.load(std::memory_order_acquire) == _ring &&
+        _ring_recv([&t_ptr](T& front) {
+          t_ptr = make_unique<T>(std::move(front)); }))
+      return t_ptr;
+
+    _upgrade();
+    return m_locking->recv_ptr();
+  }
+};
+
+}
+
+/// Channel that starts as a lock-free SPSC queue
+
+/// Like a cpp::channel<T, N> with N > 0, an adaptive_channel<T, N> is a
+/// first-class value with a queue of N elements. As long as only one
+/// thread sends and only one thread receives, the elements go through a
+/// lock-free ring buffer. The first time that a second sender or
+/// receiver thread uses the channel, it upgrades itself to the engine
+/// of cpp::channel<T, N>, and the queued elements move over in order.
+/// The upgrade is permanent, and mode() records the topology that was
+/// observed. Threads are told apart by std::thread::id, which may be
+/// reused once a thread has exited.
+///
+/// A full or empty ring first yields and then sleeps, so blocking works
+/// as for a cpp::channel. Unlike a cpp::channel, a send into a ring
+/// returns as soon as its element has been queued, and operations on a
+/// ring are not reported to trace, topology, profile or record.
+/// Unbuffered channels would need a handshake, so N must be positive.
+template<class T, std::size_t N>
+class adaptive_channel
+{
+private:
+  std::shared_ptr<internal::_adaptive_channel<T, N>> m_channel_ptr;
+
+public:
+  // Propagates exceptions thrown by std::condition_variable constructor
+  adaptive_channel()
+  : m_channel_ptr(std::make_shared<internal::_adaptive_channel<T, N>>()) {}
+
+  adaptive_channel(const adaptive_channel& other) noexcept
+  : m_channel_ptr(other.m_channel_ptr) {}
+
+  adaptive_channel& operator=(const adaptive_channel& other) noexcept
+  {
+    m_channel_ptr = other.m_channel_ptr;
+    return *this;
+  }
+
+  bool operator==(const adaptive_channel& other) const noexcept
+  {
+    return m_channel_ptr == other.m_channel_ptr;
+  }
+
+  bool operator!=(const adaptive_channel& other) const noexcept
+  {
+    return m_channel_ptr != other.m_channel_ptr;
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait()
+  void send(const T& t)
+  {
+    m_channel_ptr->send(t);
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait()
+  void send(T&& t)
+  {
+    m_channel_ptr->send(std::move(t));
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait()
+  T recv()
+  {
+    static_assert(internal::_is_exception_safe<T>::value,
+      "Cannot guarantee exception safety, use another recv operator");
+
+    return m_channel_ptr->recv();
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait()
+  void recv(T& t)
+  {
+    m_channel_ptr->recv(t);
+  }
+
+  // Propagates exceptions thrown by std::condition_variable::wait()
+  std::unique_ptr<T> recv_ptr()
+  {
+    return m_channel_ptr->recv_ptr();
+  }
+
+  /// Topology observed so far
+  adaptive_mode mode() const
+  {
+    return m_channel_ptr->mode();
+  }
+
+  /// Has the channel switched to the locking engine?
+  bool is_upgraded() const
+  {
+    return m_channel_ptr->is_upgraded();
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,52 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_BLOCKED_H
+#define CPP_CHANNEL_BLOCKED_H
+
+#include <csignal>
+#include <ostream>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+/// Which thread is parked on which channel
+
+/// Similar to Go's goroutine dump, a report lists every thread that is
+/// currently blocked in a send, receive or select, together with the
+/// channel and for how long it has been blocked.
+///
+/// The report also names wait-for cycles. A thread blocked on a channel
+/// is assumed to wait for the thread that most recently performed the
+/// complementary operation on that channel before it blocked. If such
+/// threads wait for each other in a cycle, the program has likely
+/// deadlocked.
+///
+/// At most blocked::capacity threads are tracked at the same time. Only
+/// one report is written at a time; a dump that interrupts another one,
+/// e.g. in a signal handler, writes a single line that says so.
+namespace blocked
+{
+
+constexpr std::size_t capacity = 1024;
+
+/// Writes a report of all currently blocked threads
+void dump(std::ostream&);
+
+/// Writes the report to a file descriptor, async-signal-safe
+void dump(int fd);
+
+/// Dumps to stderr whenever the process receives signal signum
+
+/// Returns false if and only if the signal handler could not be
+/// installed. The program continues to run after the dump.
+bool install_handler(int signum = SIGQUIT);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_HOOK_H
+#define CPP_CHANNEL_HOOK_H
+
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// Statically defined tracing (USDT) probes for perf, bpftrace and
+// SystemTap. Each probe site is a single nop until a tracer attaches
+// to it. Unless CPP_CHANNEL_USDT is defined, probe sites vanish.
+//
+// Every probe passes the address of the channel, the number of queued
+// elements and the size of an element in bytes.
+#ifdef CPP_CHANNEL_USDT
+#include <sys/sdt.h>
+#define CPP_CHANNEL_PROBE(name, channel, depth, size) \
+  DTRACE_PROBE3(cppchannel, name, channel, depth, size)
+#else
+// unevaluated, so it generates no code but still uses depth
+#define CPP_CHANNEL_PROBE(name, channel, depth, size) ((void)sizeof(depth))
+#endif
+
+namespace cpp
+{
+
+namespace internal
+{
+
+// Points in a channel operation that can be observed at runtime
+enum class _event : unsigned char
+{
+  send_begin,
+  send_block,
+  enqueue,
+  withdraw,
+  send_end,
+  recv_begin,
+  recv_block,
+  dequeue,
+  recv_end,
+  select_begin,
+  select_end
+};
+
+// Each bit enables one kind of instrumentation
+enum : unsigned
+{
+  _hook_trace = 1u << 0,
+  _hook_topology = 1u << 1,
+  _hook_profile = 1u << 2,
+  _hook_record = 1u << 3
+};
+
+extern std::atomic<unsigned> _hook_mask;
+
+// Forwards e to every instrumentation enabled in _hook_mask
+void _hook_emit(_event e, const void* object, std::uint64_t seq,
+  std::size_t size);
+
+// Observes a channel or select operation. If all instrumentation is
+// off, this costs one relaxed load and one well-predicted branch.
+//
+// For enqueue, withdraw and dequeue events, seq is the position of the
+// element in the channel's FIFO order and size is the size of the
+// element in bytes; otherwise, both are zero. A withdraw event takes
+// back the element of the calling thread's preceding enqueue, which is
+// never dequeued, e.g. because a send_for() timed out.
+inline void _hook(_event e, const void* object, std::uint64_t seq = 0,
+  std::size_t size = 0)
+{
+  if (_hook_mask.load(std::memory_order_relaxed) != 0)
+    _hook_emit(e, object, seq, size);
+}
+
+// Most recent threads that sent and received on a channel. A thread
+// blocked on the channel is likely waiting for the other party.
+struct _parties
+{
+  std::atomic<std::thread::id> last_sender;
+  std::atomic<std::thread::id> last_receiver;
+
+  _parties()
+  : last_sender(std::thread::id()),
+    last_receiver(std::thread::id()) {}
+};
+
+enum class _blocked_op : unsigned char
+{
+  none,
+  send,
+  recv,
+  select
+};
+
+// Publishes that the calling thread is parked on a channel or in a
+// select for as long as this object lives, see cpp::blocked::dump().
+// The parties are only read by the constructor.
+class _blocked_scope
+{
+private:
+  void* m_slot;
+
+public:
+  _blocked_scope(const void* object, const _parties*, _blocked_op);
+  ~_blocked_scope();
+
+  _blocked_scope(const _blocked_scope&) = delete;
+  _blocked_scope& operator=(const _blocked_scope&) = delete;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,268 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_PARALLEL_H
+#define CPP_CHANNEL_PARALLEL_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <exception>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+// Most elements that a worker claims at once
+constexpr std::size_t _max_claim = 64;
+
+// Elements that the workers of a parallel_for_each() or parallel_reduce()
+// have yet to claim, and the first exception that one of them threw
+class _parallel_state
+{
+private:
+  const unsigned m_workers;
+  std::atomic<std::size_t> m_remaining;
+  std::atomic<bool> m_is_aborted;
+  std::mutex m_recv_mutex;
+  std::mutex m_error_mutex;
+  std::exception_ptr m_error;
+
+public:
+  _parallel_state(unsigned workers, std::size_t n)
+  : m_workers(workers),
+    m_remaining(n),
+    m_is_aborted(false),
+    m_recv_mutex(),
+    m_error_mutex(),
+    m_error() {}
+
+  // Held by the worker that receives. Otherwise, every send would wake
+  // another idle worker, which would find at most a few elements.
+  std::mutex& recv_mutex()
+  {
+    return m_recv_mutex;
+  }
+
+  // Returns how many elements the calling worker has to receive next,
+  // or 0 if there are none left. Claims shrink with the remaining
+  // elements, so that the workers finish at about the same time.
+  std::size_t claim()
+  {
+    std::size_t remaining = m_remaining.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      if (remaining == 0 || m_is_aborted.load(std::memory_order_relaxed))
+        return 0;
+
+      const std::size_t k = std::max<std::size_t>(1,
+        std::min(_max_claim, remaining / (2 * m_workers)));
+      if (m_remaining.compare_exchange_weak(remaining, remaining - k,
+            std::memory_order_relaxed))
+        return k;
+    }
+  }
+
+  bool is_aborted() const
+  {
+    return m_is_aborted.load(std::memory_order_relaxed);
+  }
+
+  // Stops all workers after their current element
+  void abort(std::exception_ptr error)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_error_mutex);
+      if (!m_error)
+        m_error = error;
+    }
+    m_is_aborted.store(true, std::memory_order_relaxed);
+  }
+
+  void rethrow()
+  {
+    if (m_error)
+      std::rethrow_exception(m_error);
+  }
+};
+
+// Receives k claimed elements of in, draining as many queued ones as
+// possible under one lock, and calls f(std::move(t)) for each element t
+// until the workers are aborted. Only one worker at a time waits for
+// elements, while the others call f.
+template<class T, std::size_t N, class Function>
+void _parallel_recv(const ichannel<T, N>& in, _parallel_state& state,
+  std::size_t k, std::vector<T>& batch, Function& f)
+{
+  while (k > 0 && !state.is_aborted())
+  {
+    batch.clear();
+    {
+      std::lock_guard<std::mutex> lock(state.recv_mutex());
+      k -= _access::get(in).recv_n(batch, k);
+    }
+
+    for (T& t : batch)
+    {
+      if (state.is_aborted())
+        return;
+
+      f(std::move(t));
+    }
+  }
+}
+
+// Runs work(state, w) for every worker w, where the calling thread is
+// worker 0, and rethrows the first exception of any worker
+template<class Work>
+void _parallel(unsigned workers, std::size_t n, Work work)
+{
+  if (workers == 0)
+    workers = std::max(1u, std::thread::hardware_concurrency());
+
+  _parallel_state state(workers, n);
+  auto guarded = [&state, &work](unsigned w)
+  {
+    try
+    {
+      work(state, w);
+    }
+    catch (...)
+    {
+      state.abort(std::current_exception());
+    }
+  };
+
+  std::vector<std::thread> threads;
+  try
+  {
+    for (unsigned w = 1; w < workers; w++)
+      threads.emplace_back(guarded, w);
+  }
+  catch (...)
+  {
+    state.abort(std::current_exception());
+  }
+
+  guarded(0);
+  for (std::thread& thread : threads)
+    thread.join();
+
+  state.rethrow();
+}
+
+}
+
+/// Calls f(std::move(t)) for the next n elements t of in on workers threads
+
+/// Every worker claims a batch of elements at a time, and receives as
+/// many of them as are queued under a single lock of the channel before
+/// it calls f on each; there is no channel for results. Only one worker
+/// at a time waits for elements, so that a send wakes at most one.
+/// Batches shrink as fewer elements remain, and hold at most 64
+/// elements. Since channels cannot be closed, n tells the workers when
+/// to stop. With workers == 0, there is a worker for every CPU. The
+/// calling thread is one of the workers. f is called concurrently, and
+/// must be thread-safe. Elements are moved, so T need only be
+/// move-constructible.
+///
+/// If f throws, the workers stop after their current element, and the
+/// first exception is rethrown once all of them have stopped; elements
+/// that no worker received by then stay in the channel, whereas those
+/// that a worker received but did not pass to f yet are dropped.
+///
+/// Propagates exceptions thrown by f, by std::thread constructor and by
+/// std::condition_variable::wait()
+template<class T, std::size_t N, class Function>
+void parallel_for_each(ichannel<T, N> in, std::size_t n, Function f,
+  unsigned workers = 0)
+{
+  internal::_parallel(workers, n,
+    [&in, &f](internal::_parallel_state& state, unsigned)
+    {
+      std::vector<T> batch;
+      batch.reserve(internal::_max_claim);
+      for (std::size_t k = state.claim(); k > 0; k = state.claim())
+        internal::_parallel_recv(in, state, k, batch, f);
+    });
+}
+
+template<class T, std::size_t N, class Function>
+void parallel_for_each(const channel<T, N>& in, std::size_t n, Function f,
+  unsigned workers = 0)
+{
+  parallel_for_each(ichannel<T, N>(in), n, f, workers);
+}
+
+/// Combines init and the next n elements of in with op on workers threads
+
+/// op is called as T(T&&, T&&), and must be associative and commutative.
+/// Every worker folds the elements that it receives into an accumulator
+/// of its own, and the accumulators are combined with init only after
+/// all workers have finished; there is no channel for results. Batches
+/// and workers are as for parallel_for_each(). For example:
+///
+///     const long sum = cpp::parallel_reduce(in, n, 0L,
+///       [](long a, long b) { return a + b; });
+///
+/// If op throws, the workers stop after their current element, and the
+/// first exception is rethrown once all of them have stopped.
+///
+/// Propagates exceptions thrown by op, by std::thread constructor and by
+/// std::condition_variable::wait()
+template<class T, std::size_t N, class Operation>
+T parallel_reduce(ichannel<T, N> in, std::size_t n, T init, Operation op,
+  unsigned workers = 0)
+{
+  if (workers == 0)
+    workers = std::max(1u, std::thread::hardware_concurrency());
+
+  // null for a worker that received no element
+  std::vector<std::unique_ptr<T>> partials(workers);
+  internal::_parallel(workers, n,
+    [&in, &op, &partials](internal::_parallel_state& state, unsigned w)
+    {
+      std::unique_ptr<T> partial;
+      auto fold = [&op, &partial](T&& t)
+      {
+        if (partial)
+          *partial = op(std::move(*partial), std::move(t));
+        else
+          partial = internal::make_unique<T>(std::move(t));
+      };
+
+      std::vector<T> batch;
+      batch.reserve(internal::_max_claim);
+      for (std::size_t k = state.claim(); k > 0; k = state.claim())
+        internal::_parallel_recv(in, state, k, batch, fold);
+      partials[w] = std::move(partial);
+    });
+
+  for (std::unique_ptr<T>& partial : partials)
+  {
+    if (partial)
+      init = op(std::move(init), std::move(*partial));
+  }
+  return init;
+}
+
+template<class T, std::size_t N, class Operation>
+T parallel_reduce(const channel<T, N>& in, std::size_t n, T init,
+  Operation op, unsigned workers = 0)
+{
+  return parallel_reduce(ichannel<T, N>(in), n, std::move(init), op,
+    workers);
+}
+
+}
+
+#endif
@@ -0,0 +1,470 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_PIPELINE_H
+#define CPP_CHANNEL_PIPELINE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+/// What the pipeline builder knows about a stage
+struct stage_hint
+{
+  /// Estimated nanoseconds per element, negative if unknown
+  double ns;
+
+  /// Does the stage keep state from one element to the next?
+  bool is_stateful;
+};
+
+/// Stage that takes about ns nanoseconds per element
+inline stage_hint cost(double ns)
+{
+  return stage_hint{ns, false};
+}
+
+/// Stage that keeps state and is never fused with its neighbours
+inline stage_hint stateful(double ns = -1)
+{
+  return stage_hint{ns, true};
+}
+
+/// Parameters of the fusion and sizing decisions
+struct pipeline_options
+{
+  /// Nanoseconds to pass an element through a channel to another thread
+  double hop_ns;
+
+  /// Nanoseconds that a worker should spend on a segment at a time
+  double step_ns;
+
+  /// Measured nanoseconds per element of stages by name, which take
+  /// precedence over their hints; see pipeline::measured()
+  std::map<std::string, double> profile;
+
+  pipeline_options()
+  : hop_ns(500),
+    step_ns(20000),
+    profile() {}
+};
+
+namespace internal
+{
+
+// Type-erased element of a stage's input or output
+struct _value
+{
+  virtual ~_value() {}
+};
+
+// What travels through the channel between two segments
+template<class T>
+struct _token
+{
+  T value;
+  bool is_end;
+};
+
+template<class T>
+struct _slot : public _value
+{
+  _token<T> token;
+
+  _slot()
+  : token{T(), false} {}
+};
+
+template<class T>
+T& _get(_value& v)
+{
+  return static_cast<_slot<T>&>(v).token.value;
+}
+
+enum class _pop_result : unsigned char
+{
+  empty,
+  value,
+  end
+};
+
+// Channel between two segments, with a single sender and receiver
+class _link
+{
+public:
+  virtual ~_link() {}
+
+  // Moves from value if and only if it returns true
+  virtual bool try_push(_value& value) = 0;
+  virtual bool try_push_end() = 0;
+  virtual _pop_result try_pop(_value& value) = 0;
+};
+
+template<class T, std::size_t N>
+class _channel_link : public _link
+{
+private:
+  channel<_token<T>, N> m_channel;
+
+public:
+  _channel_link()
+  : m_channel() {}
+
+  bool try_push(_value& value) override
+  {
+    // try_send() only moves from its argument if it succeeds
+    return m_channel.try_send(std::move(static_cast<_slot<T>&>(value).token));
+  }
+
+  bool try_push_end() override
+  {
+    return m_channel.try_send(_token<T>{T(), true});
+  }
+
+  _pop_result try_pop(_value& value) override
+  {
+    _token<T>& token = static_cast<_slot<T>&>(value).token;
+    if (!m_channel.try_recv(token))
+      return _pop_result::empty;
+
+    return token.is_end ? _pop_result::end : _pop_result::value;
+  }
+};
+
+// Rounds capacity up to one of the few channel sizes that links have
+inline std::size_t _link_capacity(std::size_t capacity)
+{
+  if (capacity <= 16)
+    return 16;
+  if (capacity <= 64)
+    return 64;
+  if (capacity <= 256)
+    return 256;
+
+  return 1024;
+}
+
+template<class T>
+std::unique_ptr<_link> _make_link(std::size_t capacity)
+{
+  switch (_link_capacity(capacity))
+  {
+  case 16:
+    return make_unique<_channel_link<T, 16>>();
+  case 64:
+    return make_unique<_channel_link<T, 64>>();
+  case 256:
+    return make_unique<_channel_link<T, 256>>();
+  default:
+    return make_unique<_channel_link<T, 1024>>();
+  }
+}
+
+class _pipeline_stage
+{
+public:
+  const std::string name;
+  const stage_hint hint;
+
+  _pipeline_stage(const std::string& n, stage_hint h)
+  : name(n),
+    hint(h) {}
+
+  virtual ~_pipeline_stage() {}
+
+  // Holds the output of this stage
+  virtual std::unique_ptr<_value> make_slot() const = 0;
+
+  // Carries the output of this stage to the next segment
+  virtual std::unique_ptr<_link> make_link(std::size_t capacity) const = 0;
+
+  // Computes out from in. Returns false if there is no output, i.e. at
+  // the end of a source's stream, for an element that a filter drops,
+  // and always for a sink.
+  virtual bool apply(_value& in, _value& out) = 0;
+};
+
+template<class T>
+class _typed_stage : public _pipeline_stage
+{
+public:
+  _typed_stage(const std::string& n, stage_hint h)
+  : _pipeline_stage(n, h) {}
+
+  std::unique_ptr<_value> make_slot() const override
+  {
+    return make_unique<_slot<T>>();
+  }
+
+  std::unique_ptr<_link> make_link(std::size_t capacity) const override
+  {
+    return _make_link<T>(capacity);
+  }
+};
+
+template<class T, class Source>
+class _source_stage : public _typed_stage<T>
+{
+private:
+  Source m_source;
+
+public:
+  _source_stage(const std::string& n, stage_hint h, Source source)
+  : _typed_stage<T>(n, h),
+    m_source(source) {}
+
+  bool apply(_value&, _value& out) override
+  {
+    return m_source(_get<T>(out));
+  }
+};
+
+template<class T, class U, class Function>
+class _map_stage : public _typed_stage<U>
+{
+private:
+  Function m_f;
+
+public:
+  _map_stage(const std::string& n, stage_hint h, Function f)
+  : _typed_stage<U>(n, h),
+    m_f(f) {}
+
+  bool apply(_value& in, _value& out) override
+  {
+    _get<U>(out) = m_f(std::move(_get<T>(in)));
+    return true;
+  }
+};
+
+template<class T, class Predicate>
+class _filter_stage : public _typed_stage<T>
+{
+private:
+  Predicate m_pred;
+
+public:
+  _filter_stage(const std::string& n, stage_hint h, Predicate pred)
+  : _typed_stage<T>(n, h),
+    m_pred(pred) {}
+
+  bool apply(_value& in, _value& out) override
+  {
+    T& t = _get<T>(in);
+    if (!m_pred(static_cast<const T&>(t)))
+      return false;
+
+    _get<T>(out) = std::move(t);
+    return true;
+  }
+};
+
+template<class T, class Sink>
+class _sink_stage : public _pipeline_stage
+{
+private:
+  Sink m_sink;
+
+public:
+  _sink_stage(const std::string& n, stage_hint h, Sink sink)
+  : _pipeline_stage(n, h),
+    m_sink(sink) {}
+
+  std::unique_ptr<_value> make_slot() const override
+  {
+    return make_unique<_value>();
+  }
+
+  std::unique_ptr<_link> make_link(std::size_t) const override
+  {
+    return nullptr;
+  }
+
+  bool apply(_value& in, _value&) override
+  {
+    m_sink(std::move(_get<T>(in)));
+    return false;
+  }
+};
+
+typedef std::vector<std::shared_ptr<_pipeline_stage>> _stages;
+
+}
+
+/// Pipeline with a plan of which stages run together
+
+/// A pipeline is built by make_pipeline(). Its stages are grouped into
+/// segments: the stages of a segment run one after the other for each
+/// element, in one loop and without a channel in between, and a bounded
+/// cpp::channel connects each segment to the next. Adjacent stages are
+/// fused into one segment unless one of them keeps state, or splitting
+/// them would pay off: two segments can work on different elements at
+/// the same time, but every element then pays a channel hop. Thus, a
+/// stage is fused with its neighbour if the cheaper of the two costs at
+/// most pipeline_options::hop_ns per element. Stages of unknown cost are
+/// assumed to be expensive.
+///
+/// run() shares a pool of worker threads among all segments, so that a
+/// pipeline never needs a thread per stage. A worker runs a segment for
+/// a batch of elements that takes about pipeline_options::step_ns, and
+/// moves on once the segment's input is empty or its output is full.
+/// The channel after a segment is sized such that the segments on both
+/// of its ends can run a full batch.
+class pipeline
+{
+public:
+  /// Stages that run together, and how
+  struct segment
+  {
+    /// Names of the fused stages, in order
+    std::vector<std::string> stages;
+
+    /// Estimated nanoseconds per element, negative if unknown
+    double ns;
+
+    /// Elements per step
+    std::size_t batch;
+
+    /// Capacity of the channel to the next segment, 0 for the last one
+    std::size_t capacity;
+  };
+
+private:
+  internal::_stages m_stages;
+  std::vector<segment> m_segments;
+  std::map<std::string, double> m_measured;
+
+public:
+  pipeline(internal::_stages stages, const pipeline_options& options);
+
+  const std::vector<segment>& segments() const
+  {
+    return m_segments;
+  }
+
+  /// Writes the segments, their batches and channel capacities
+  void write(std::ostream&) const;
+
+  /// Runs until the source's stream ends and the sink has received
+  /// every element that reaches it
+
+  /// With workers == 0, there is a worker for every CPU, but never more
+  /// workers than segments. The calling thread is one of the workers.
+  /// If a stage throws, the other workers stop after their current
+  /// step, and run() rethrows the first exception; the elements still
+  /// in the pipeline are discarded.
+  ///
+  /// Propagates exceptions thrown by the stages and by std::thread
+  /// constructor
+  void run(unsigned workers = 0);
+
+  /// Nanoseconds per element of each stage, as sampled by the last run()
+
+  /// Pass them as pipeline_options::profile to build the pipeline again
+  /// with measured rather than estimated costs.
+  const std::map<std::string, double>& measured() const
+  {
+    return m_measured;
+  }
+};
+
+/// Declarative builder of a pipeline whose last stage produces T
+
+/// Every stage has a name and a stage_hint. Like a std::function, a
+/// builder holds copies of the stages' functions, which are shared by
+/// all builders and pipelines made from it. A pipeline runs each
+/// function on only one thread at a time.
+template<class T>
+class pipeline_builder
+{
+private:
+  template<class U>
+  friend class pipeline_builder;
+
+  template<class U, class Source>
+  friend pipeline_builder<U> make_pipeline(const std::string&, Source,
+    stage_hint);
+
+  internal::_stages m_stages;
+
+  explicit pipeline_builder(internal::_stages stages)
+  : m_stages(std::move(stages)) {}
+
+  pipeline_builder then(std::shared_ptr<internal::_pipeline_stage> s) const
+  {
+    internal::_stages stages(m_stages);
+    stages.push_back(std::move(s));
+    return pipeline_builder(std::move(stages));
+  }
+
+public:
+  /// Appends a stage that turns every element t into f(std::move(t))
+  template<class Function, class U = typename std::decay<
+    typename std::result_of<Function(T&&)>::type>::type>
+  pipeline_builder<U> map(const std::string& name, Function f,
+    stage_hint hint = cost(-1)) const
+  {
+    internal::_stages stages(m_stages);
+    stages.push_back(std::make_shared<internal::_map_stage<T, U, Function>>(
+      name, hint, f));
+    return pipeline_builder<U>(std::move(stages));
+  }
+
+  /// Appends a stage that drops every element t for which !pred(t)
+  template<class Predicate>
+  pipeline_builder filter(const std::string& name, Predicate pred,
+    stage_hint hint = cost(-1)) const
+  {
+    return then(std::make_shared<internal::_filter_stage<T, Predicate>>(
+      name, hint, pred));
+  }
+
+  /// Ends the pipeline with a stage that calls sink(std::move(t))
+  template<class Sink>
+  pipeline to(const std::string& name, Sink sink, stage_hint hint = cost(-1),
+    const pipeline_options& options = pipeline_options()) const
+  {
+    internal::_stages stages(m_stages);
+    stages.push_back(std::make_shared<internal::_sink_stage<T, Sink>>(
+      name, hint, sink));
+    return pipeline(std::move(stages), options);
+  }
+};
+
+/// Starts a pipeline with a source of elements of type T
+
+/// The source is called as bool(T& t). It either assigns the next
+/// element to t and returns true, or returns false at the end of its
+/// stream. For example, to forward n elements from a channel:
+///
+///     cpp::make_pipeline<int>("in", [in, n](int& i) mutable -> bool
+///     {
+///       if (n == 0)
+///         return false;
+///       in.recv(i);
+///       return --n, true;
+///     }).map(...).filter(...).to("out", ...).run();
+///
+/// The types of all elements must be default constructible.
+template<class T, class Source>
+pipeline_builder<T> make_pipeline(const std::string& name, Source source,
+  stage_hint hint = cost(-1))
+{
+  return pipeline_builder<T>(internal::_stages{
+    std::make_shared<internal::_source_stage<T, Source>>(name, hint,
+      source)});
+}
+
+}
+
+#endif
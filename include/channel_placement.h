@@ -0,0 +1,184 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_PLACEMENT_H
+#define CPP_CHANNEL_PLACEMENT_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstddef>
+#include <ostream>
+
+namespace cpp
+{
+
+/// Topology-aware thread placement
+
+/// Stages of a pipeline that exchange many messages run fastest if
+/// their threads share a cache, and slowest if the messages cross
+/// sockets. Given a graph of stages, place() orders the stages such
+/// that heavily communicating ones are next to each other, and hands
+/// out CPUs in the order of the machine's cache hierarchy:
+///
+///     cpp::placement::graph g;
+///     const std::size_t parse = g.stage("parse", 2);
+///     const std::size_t index = g.stage("index");
+///     g.edge(parse, index, 1e6);
+///
+///     const cpp::placement::plan p(cpp::placement::place(g,
+///       cpp::placement::machine().allowed()));
+///     p.write(std::cerr);
+///
+///     // in the first thread of the parse stage
+///     p.pin(parse, 0);
+///
+/// CPUs are read from /sys/devices/system/cpu, or from a copy of that
+/// directory for testing. If there are more threads than CPUs, the
+/// CPUs are reused round-robin.
+namespace placement
+{
+
+/// A logical CPU and the hardware that it shares with others
+
+/// Every member except id names a group of CPUs. Two CPUs with equal
+/// core share a physical core (hyper-threads), two CPUs with equal l2
+/// or l3 share that cache, and two CPUs with equal package share a
+/// socket. Unknown groups are -1, which is shared with no other CPU.
+struct cpu
+{
+  int id;
+  int core;
+  int l2;
+  int l3;
+  int package;
+};
+
+/// How close two CPUs are, from closest to farthest
+enum class sharing : unsigned char
+{
+  same_cpu,
+  core,
+  l2,
+  l3,
+  package,
+  none
+};
+
+/// Closest hardware that two CPUs share
+sharing shared(const cpu&, const cpu&);
+
+const char* to_string(sharing);
+
+/// CPUs of a machine
+class machine
+{
+private:
+  std::vector<cpu> m_cpus;
+
+public:
+  /// Reads the online CPUs from root
+
+  /// Throws std::runtime_error if root does not list any CPU
+  explicit machine(const std::string& root = "/sys/devices/system/cpu");
+
+  explicit machine(std::vector<cpu> cpus)
+  : m_cpus(std::move(cpus)) {}
+
+  /// CPUs ordered by id
+  const std::vector<cpu>& cpus() const
+  {
+    return m_cpus;
+  }
+
+  /// Only the CPUs that the calling thread may run on
+
+  /// Returns *this if the affinity mask cannot be read, or if it
+  /// contains none of the CPUs.
+  machine allowed() const;
+};
+
+/// Stages and how much they communicate
+class graph
+{
+public:
+  struct stage_info
+  {
+    std::string name;
+    unsigned threads;
+  };
+
+  struct edge_info
+  {
+    std::size_t from;
+    std::size_t to;
+    double weight;
+  };
+
+private:
+  std::vector<stage_info> m_stages;
+  std::vector<edge_info> m_edges;
+
+public:
+  /// Adds a stage with at least one thread, returns its id
+  std::size_t stage(const std::string& name, unsigned threads = 1);
+
+  /// Declares that stages from and to exchange weight messages
+
+  /// Any unit works, for instance messages per second as reported by
+  /// cpp::topology. Edges between the same stages add up.
+  ///
+  /// Throws std::out_of_range if from or to is not a stage id
+  void edge(std::size_t from, std::size_t to, double weight = 1);
+
+  const std::vector<stage_info>& stages() const
+  {
+    return m_stages;
+  }
+
+  const std::vector<edge_info>& edges() const
+  {
+    return m_edges;
+  }
+};
+
+/// CPU of every thread of every stage
+class plan
+{
+private:
+  graph m_graph;
+  std::vector<std::vector<cpu>> m_cpus;
+
+public:
+  plan(const graph& g, std::vector<std::vector<cpu>> cpus)
+  : m_graph(g),
+    m_cpus(std::move(cpus)) {}
+
+  /// CPU of the given thread of the given stage
+
+  /// Throws std::out_of_range if there is no such thread
+  const cpu& at(std::size_t stage, unsigned thread) const;
+
+  /// Pins the calling thread to at(stage, thread)
+
+  /// Returns false if and only if the thread could not be pinned
+  bool pin(std::size_t stage, unsigned thread) const;
+
+  /// Pins t to at(stage, thread)
+  bool pin(std::thread& t, std::size_t stage, unsigned thread) const;
+
+  /// Writes the CPU of every thread and how close every edge's stages are
+  void write(std::ostream&) const;
+};
+
+/// Places the threads of g on the CPUs of m
+
+/// Throws std::invalid_argument if m has no CPUs
+plan place(const graph& g, const machine& m);
+
+}
+
+}
+
+#endif
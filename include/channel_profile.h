@@ -0,0 +1,121 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_PROFILE_H
+#define CPP_CHANNEL_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+struct _stage;
+
+// Accounts time that the calling thread's stage is blocked
+void _profile_record(_event e);
+
+}
+
+/// Pipeline stage profiler
+
+/// Splits the time of each stage of a pipeline into busy time (the CPU
+/// time of its threads), time blocked receiving from its input channels
+/// and time blocked sending to its output channels. The stage that is
+/// busy for the largest fraction of its time limits the throughput of
+/// the whole pipeline.
+///
+/// Every thread of a stage declares its membership with a stage_scope:
+///
+///     void filter(cpp::ichannel<int> in, cpp::ochannel<int> out)
+///     {
+///       cpp::profile::stage_scope scope("filter");
+///       for (;;)
+///         out.send(in.recv() + 1);
+///     }
+///
+/// A thread's times are added to its stage when its scope ends.
+namespace profile
+{
+
+/// Starts observing blocked stages, and clears all previous results
+void start();
+
+/// Stops observing blocked stages, the results are kept
+void stop();
+
+/// Is observing?
+bool is_started();
+
+/// Attributes the calling thread's time to a stage while it lives
+
+/// Only the part of its lifetime since the last start() counts, and only
+/// if profiling has not been stopped by the time the scope ends.
+class stage_scope
+{
+private:
+  internal::_stage* m_stage;
+  internal::_stage* m_outer;
+  long long m_outer_input_blocked_ns;
+  long long m_outer_output_blocked_ns;
+  long long m_outer_started_ns;
+  long long m_start_ns;
+  long long m_start_cpu_ns;
+
+public:
+  explicit stage_scope(const std::string& stage);
+  ~stage_scope();
+
+  stage_scope(const stage_scope&) = delete;
+  stage_scope& operator=(const stage_scope&) = delete;
+};
+
+/// Times of one stage, in seconds, summed over its threads
+struct stage
+{
+  std::string name;
+  unsigned threads;
+  double wall;
+  double busy;
+  double input_blocked;
+  double output_blocked;
+
+  /// Fraction of time that an average thread of the stage is busy
+  double utilization() const
+  {
+    return wall > 0 ? busy / wall : 0;
+  }
+};
+
+struct report
+{
+  std::vector<stage> stages;
+
+  /// Index of the stage with the highest utilization, if any
+  std::size_t bottleneck;
+
+  /// Estimated throughput factor if the bottleneck had one more thread
+
+  /// With threads w and utilization u of the bottleneck, and utilization
+  /// u' of the next busiest stage, the factor is min((w + 1) / w, u / u').
+  double gain;
+};
+
+/// Summarizes all stage_scopes that have ended since start()
+report summarize();
+
+/// Writes summarize() as a table, naming the bottleneck
+void write(std::ostream&);
+
+}
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_RECORD_H
+#define CPP_CHANNEL_RECORD_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <ostream>
+#include <istream>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+// Appends an enqueue or dequeue to the calling thread's recording
+void _record_event(_event e, const void* object, std::size_t size);
+
+// Attaches payload to the calling thread's next enqueue into channel
+void _record_payload(const void* channel, std::string&& payload);
+
+// Is recording?
+bool _record_is_started();
+
+// Serializes every enqueued element while recording
+template<class T, class Serializer>
+class _record_tap : public _tap<T>
+{
+private:
+  const void* const m_channel;
+  Serializer m_serializer;
+
+public:
+  _record_tap(const void* channel, Serializer s)
+  : m_channel(channel),
+    m_serializer(s) {}
+
+  void mirror(const T& t) override
+  {
+    if (_record_is_started())
+      _record_payload(m_channel, m_serializer(t));
+  }
+};
+
+}
+
+/// Record and replay of channel traffic
+
+/// Records the time, channel and element size of every enqueue and
+/// dequeue into a compact binary file. Optionally, the elements sent
+/// into a channel are serialized into the file as well. A replayer
+/// reads such a file and sends into a channel with the same arrival
+/// pattern as the recorded one, so that a pipeline can be measured
+/// under a realistic traffic shape.
+///
+///     cpp::trace::name(c, "requests");
+///     cpp::record::capture(c, [](const request& r) { return r.str(); });
+///     cpp::record::start();
+///     ...
+///     cpp::record::stop();
+///     cpp::record::write("traffic.rec");
+///
+/// and later, against a test build:
+///
+///     cpp::record::replayer r("traffic.rec");
+///     r.replay(r.find("requests"), c,
+///       [](const cpp::record::event& e) { return request(e.payload); });
+///
+/// Channels are identified by the name that trace::name() gave them,
+/// if any, and otherwise by the order in which they first appear.
+///
+/// The file starts with the magic bytes "CPPCHREC", followed by
+/// unsigned LEB128 integers: the version (1), the number of channels,
+/// for each channel the length and bytes of its name, the number of
+/// events, and for each event the nanoseconds since the previous one,
+/// the channel, the operation (0 = send, 1 = receive), the size of the
+/// element type, and the length and bytes of its serialized payload.
+namespace record
+{
+
+/// Starts recording, and discards events recorded before this call
+void start();
+
+/// Stops recording, the recorded events are kept
+void stop();
+
+/// Is recording?
+bool is_started();
+
+/// Serializes every element sent into c while recording
+
+/// The serializer is called as std::string(const T&) while the channel
+/// is locked. This replaces any tap of c, see channel<T, N>::tap().
+template<class T, std::size_t N, class Serializer>
+void capture(const channel<T, N>& c, Serializer serializer)
+{
+  internal::_channel<T, N>& tapped = internal::_access::get(c);
+  tapped.tap(internal::make_unique<internal::_record_tap<T, Serializer>>(
+    &tapped, serializer));
+}
+
+/// Writes the recorded events in the binary format described above
+
+/// For a consistent snapshot, call stop() first.
+void write(std::ostream&);
+
+/// Returns false if and only if the file could not be written
+bool write(const std::string& path);
+
+enum class operation : unsigned char
+{
+  send = 0,
+  recv = 1
+};
+
+/// One recorded enqueue or dequeue
+struct event
+{
+  /// Nanoseconds since recording started
+  std::uint64_t time;
+
+  /// Index into replayer::channels()
+  std::uint32_t channel;
+
+  operation op;
+
+  /// Size of the element type in bytes, i.e. sizeof(T) for a channel
+  /// of T, for sends and receives alike; the size of a captured element
+  /// is payload.size()
+  std::uint32_t size;
+
+  /// Serialized element, empty unless captured
+  std::string payload;
+};
+
+/// Reads a recording, and sends into channels as recorded
+class replayer
+{
+private:
+  std::vector<std::string> m_channels;
+  std::vector<event> m_events;
+
+public:
+  /// Throws std::runtime_error if the file is missing or malformed
+  explicit replayer(const std::string& path);
+
+  /// Throws std::runtime_error if the stream is malformed
+  explicit replayer(std::istream&);
+
+  /// Names of the recorded channels, empty if unnamed
+  const std::vector<std::string>& channels() const
+  {
+    return m_channels;
+  }
+
+  /// Recorded events, ordered by time
+  const std::vector<event>& events() const
+  {
+    return m_events;
+  }
+
+  /// Index of the channel with the given name, or channels().size()
+  std::size_t find(const std::string& name) const;
+
+  /// Sends make(e) into c for every recorded send e into channel id
+
+  /// Every send begins at its recorded time, divided by speed, relative
+  /// to the call. If c blocks, later sends begin as soon as possible.
+  /// Returns the number of sent elements.
+  ///
+  /// Propagates exceptions thrown by make and by c.send()
+  template<class T, std::size_t N, class Factory>
+  std::size_t replay(std::size_t id, ochannel<T, N> c, Factory make,
+    double speed = 1.0) const
+  {
+    const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+    std::size_t sent = 0;
+    for (const event& e : m_events)
+    {
+      if (e.channel != id || e.op != operation::send)
+        continue;
+
+      std::this_thread::sleep_until(start +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double, std::nano>(e.time / speed)));
+      c.send(make(e));
+      sent++;
+    }
+    return sent;
+  }
+
+  template<class T, std::size_t N, class Factory>
+  std::size_t replay(std::size_t id, const channel<T, N>& c,
+    Factory make, double speed = 1.0) const
+  {
+    return replay(id, ochannel<T, N>(c), make, speed);
+  }
+};
+
+}
+
+}
+
+#endif
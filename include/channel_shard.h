@@ -0,0 +1,100 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_SHARD_H
+#define CPP_CHANNEL_SHARD_H
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+struct _shard;
+
+}
+
+/// Thread-per-core runtime
+
+/// A shard_runtime starts one worker thread per shard and pins it to
+/// its own CPU. Every shard exclusively owns whatever state its tasks
+/// touch, and shards communicate only by submitting tasks to each
+/// other. For that purpose, every ordered pair of shards is connected
+/// by a bounded lock-free single-producer, single-consumer ring, so
+/// a task that a shard submits to another shard takes no lock:
+///
+///     cpp::shard_runtime runtime;
+///     std::vector<std::size_t> counts(runtime.size());
+///     runtime.submit_to(0, [&]
+///     {
+///       runtime.submit_to(1, [&] { counts[runtime.current()]++; });
+///     });
+///
+/// Every worker polls its incoming rings in batches, and sleeps once
+/// they have all been empty for a while. If a ring is full, the tasks
+/// wait in a queue that only the submitting shard accesses, so that a
+/// submission never blocks, and the tasks of one shard to another run
+/// in the order of their submission.
+///
+/// Threads other than the workers may submit as well. Such tasks go
+/// through a mutex-protected queue per shard, which is meant for
+/// starting and feeding the shards rather than for their hot path.
+class shard_runtime
+{
+public:
+  typedef std::function<void()> task;
+
+private:
+  std::vector<std::unique_ptr<internal::_shard>> m_shards;
+
+  void _stop();
+
+public:
+  /// Starts the workers
+
+  /// With shards == 0, there is one shard for every CPU that the
+  /// process may run on. Each ring holds capacity tasks, and a worker
+  /// runs at most batch tasks from one ring before it polls the next;
+  /// both are at least 1.
+  ///
+  /// Propagates exceptions thrown by std::thread constructor
+  explicit shard_runtime(unsigned shards = 0, std::size_t capacity = 256,
+    std::size_t batch = 32);
+
+  /// Stops and joins the workers
+
+  /// Every worker finishes its current task. Tasks that have not
+  /// started by then are destroyed without being run.
+  ~shard_runtime();
+
+  shard_runtime(const shard_runtime&) = delete;
+  shard_runtime& operator=(const shard_runtime&) = delete;
+
+  /// Number of shards
+  unsigned size() const
+  {
+    return static_cast<unsigned>(m_shards.size());
+  }
+
+  /// Shard of the calling worker, or size() on any other thread
+  unsigned current() const;
+
+  /// CPU that the shard's worker is pinned to, or -1 if it is not
+  int cpu(unsigned shard) const;
+
+  /// Runs fn on the worker of the given shard
+
+  /// The task must not throw. Throws std::out_of_range if shard is not
+  /// less than size().
+  void submit_to(unsigned shard, task fn);
+};
+
+}
+
+#endif
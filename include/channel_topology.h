@@ -0,0 +1,91 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_TOPOLOGY_H
+#define CPP_CHANNEL_TOPOLOGY_H
+
+#include <chrono>
+#include <string>
+#include <ostream>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+// Counts e on the edge between the calling thread and object
+void _topology_record(_event e, const void* object);
+
+}
+
+/// Communication topology profiler
+
+/// Observes which threads send to and receive from which channels. Every
+/// thread counts its operations on each channel in its own counters, so
+/// threads rarely contend with each other while profiling.
+///
+/// The resulting dataflow graph has threads and channels as vertices.
+/// Every edge is annotated with messages per second and the percentage
+/// of operations that blocked. In a pipeline, the stage whose input is
+/// rarely blocked while its neighbours' are is the bottleneck.
+///
+/// Channels are labelled with the names given to cpp::trace::name().
+namespace topology
+{
+
+/// Clears all counters and starts profiling
+
+/// Only every sample_period-th operation of each thread is counted,
+/// and counts are scaled accordingly.
+void start(unsigned sample_period = 1);
+
+/// Stops profiling, the counters are kept
+void stop();
+
+/// Is profiling?
+bool is_started();
+
+/// Labels the calling thread with the given name in the graph
+void name_thread(const std::string& name);
+
+/// Writes the graph in the Graphviz DOT language
+void write_dot(std::ostream&);
+
+/// Writes the graph as JSON
+void write_json(std::ostream&);
+
+/// Periodically overwrites a file with the current graph
+
+/// The file is written in DOT if its path ends with ".dot"; otherwise,
+/// it is written in JSON. The file is written one last time when the
+/// exporter is destroyed.
+class exporter
+{
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_stop_cv;
+  bool m_stop;
+  const std::string m_path;
+  const std::chrono::milliseconds m_period;
+  std::thread m_thread;
+
+  void write_file();
+  void run();
+
+public:
+  exporter(const std::string& path, std::chrono::milliseconds period);
+  ~exporter();
+
+  exporter(const exporter&) = delete;
+  exporter& operator=(const exporter&) = delete;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef CPP_CHANNEL_TRACE_H
+#define CPP_CHANNEL_TRACE_H
+
+#include <string>
+#include <ostream>
+
+#include <channel.h>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+// Appends e to the calling thread's trace buffer
+void _trace_record(_event e, const void* object, std::uint64_t seq);
+
+// Name given to the channel by trace::name(), or empty if none
+std::string _trace_name(const void* channel);
+
+// Writes s as a double-quoted string with JSON escape sequences
+void _write_escaped(std::ostream&, const std::string& s);
+
+}
+
+/// Event tracing of channel operations
+
+/// Records when send, receive and select operations begin, block and
+/// complete. Each thread writes into its own lock-free ring buffer, so
+/// tracing does not add contention between threads. When tracing is
+/// stopped, every channel operation pays a single branch for it.
+///
+/// The recorded events can be written in the Chrome trace event format,
+/// which can be loaded into chrome://tracing or https://ui.perfetto.dev.
+/// There, every element is drawn as a flow arrow from the send operation
+/// that enqueued it to the receive operation that dequeued it.
+///
+/// \see https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+namespace trace
+{
+
+/// Starts recording, and discards events recorded before this call
+
+/// Frees the buffers of threads that have exited since they recorded
+/// their events.
+void start();
+
+/// Stops recording, the recorded events are kept
+void stop();
+
+/// Is recording?
+bool is_started();
+
+/// Labels the channel with the given name in the written trace
+void name(const void* channel, const std::string& name);
+
+template<class T, std::size_t N>
+void name(const channel<T, N>& c, const std::string& n)
+{
+  name(&internal::_access::get(c), n);
+}
+
+template<class T, std::size_t N>
+void name(const ichannel<T, N>& c, const std::string& n)
+{
+  name(&internal::_access::get(c), n);
+}
+
+template<class T, std::size_t N>
+void name(const ochannel<T, N>& c, const std::string& n)
+{
+  name(&internal::_access::get(c), n);
+}
+
+/// Writes the recorded events as Chrome trace JSON
+
+/// For a consistent snapshot, call stop() first; otherwise, the
+/// oldest events of a full ring buffer may be overwritten while
+/// they are being written, and are left out.
+void write(std::ostream&);
+
+/// Returns false if and only if the file could not be written
+bool write(const std::string& path);
+
+}
+
+}
+
+#endif
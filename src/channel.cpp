@@ -3,7 +3,37 @@
 // license that can be found in the LICENSE file.
 
 #include <channel>
+#include <channel_trace.h>
+#include <channel_record.h>
+#include <channel_profile.h>
+#include <channel_topology.h>
 
 namespace cpp
 {
+
+namespace internal
+{
+
+std::atomic<unsigned> _hook_mask(0);
+
+void _hook_emit(_event e, const void* object, std::uint64_t seq,
+  std::size_t size)
+{
+  const unsigned mask = _hook_mask.load(std::memory_order_relaxed);
+
+  if (mask & _hook_trace)
+    _trace_record(e, object, seq);
+
+  if (mask & _hook_topology)
+    _topology_record(e, object);
+
+  if (mask & _hook_profile)
+    _profile_record(e);
+
+  if (mask & _hook_record)
+    _record_event(e, object, size);
+}
+
+}
+
 }
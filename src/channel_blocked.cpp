@@ -0,0 +1,391 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_blocked.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Since slots can be read inside a signal handler, they are never
+// freed and all their members are lock-free atomics. A slot never
+// points into a channel, which may be destroyed as soon as its blocked
+// thread wakes up.
+struct _blocked_slot
+{
+  std::atomic<bool> used;
+  std::atomic<_blocked_op> op;
+  std::atomic<const void*> object;
+  std::atomic<std::thread::id> waits_for;
+  std::atomic<std::int64_t> since;
+  std::atomic<std::thread::id> thread;
+  std::atomic<long> os_tid;
+};
+
+_blocked_slot _slots[blocked::capacity];
+
+std::int64_t _now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long _os_tid()
+{
+#ifdef __linux__
+  return static_cast<long>(::syscall(SYS_gettid));
+#else
+  return static_cast<long>(std::hash<std::thread::id>()(
+    std::this_thread::get_id()));
+#endif
+}
+
+// Claims a slot on first use, and releases it when the thread exits
+class _slot_owner
+{
+private:
+  _blocked_slot* m_slot;
+
+public:
+  _slot_owner()
+  : m_slot(nullptr)
+  {
+    for (_blocked_slot& slot : _slots)
+    {
+      bool used = false;
+      if (slot.used.compare_exchange_strong(used, true))
+      {
+        slot.op.store(_blocked_op::none, std::memory_order_relaxed);
+        slot.thread.store(std::this_thread::get_id(),
+          std::memory_order_relaxed);
+        slot.os_tid.store(_os_tid(), std::memory_order_relaxed);
+        m_slot = &slot;
+        break;
+      }
+    }
+  }
+
+  ~_slot_owner()
+  {
+    if (m_slot)
+    {
+      m_slot->op.store(_blocked_op::none, std::memory_order_relaxed);
+      m_slot->used.store(false, std::memory_order_release);
+    }
+  }
+
+  _blocked_slot* slot() const
+  {
+    return m_slot;
+  }
+};
+
+// Buffered formatting without memory allocation, so that it can be
+// used inside signal handlers
+class _writer
+{
+private:
+  typedef void (*sink)(void*, const char*, std::size_t);
+
+  char m_buffer[512];
+  std::size_t m_size;
+  sink m_sink;
+  void* m_context;
+
+public:
+  _writer(sink s, void* context)
+  : m_size(0),
+    m_sink(s),
+    m_context(context) {}
+
+  ~_writer()
+  {
+    flush();
+  }
+
+  void flush()
+  {
+    if (m_size)
+      m_sink(m_context, m_buffer, m_size);
+    m_size = 0;
+  }
+
+  _writer& operator<<(char c)
+  {
+    if (m_size == sizeof(m_buffer))
+      flush();
+    m_buffer[m_size++] = c;
+    return *this;
+  }
+
+  _writer& operator<<(const char* s)
+  {
+    while (*s)
+      *this << *s++;
+    return *this;
+  }
+
+  _writer& operator<<(std::uint64_t n)
+  {
+    char digits[20];
+    std::size_t k = 0;
+    do
+    {
+      digits[k++] = '0' + n % 10;
+      n /= 10;
+    }
+    while (n);
+
+    while (k)
+      *this << digits[--k];
+    return *this;
+  }
+
+  _writer& operator<<(const void* p)
+  {
+    static const char hex[] = "0123456789abcdef";
+    std::uintptr_t n = reinterpret_cast<std::uintptr_t>(p);
+
+    *this << "0x";
+    for (int shift = 4 * (sizeof(n) * 2 - 1); shift >= 0; shift -= 4)
+      *this << hex[(n >> shift) & 0xf];
+    return *this;
+  }
+};
+
+const char* _op_name(_blocked_op op)
+{
+  switch (op)
+  {
+  case _blocked_op::send:
+    return "send on channel ";
+  case _blocked_op::recv:
+    return "recv on channel ";
+  case _blocked_op::select:
+    return "select ";
+  default:
+    return "";
+  }
+}
+
+// Snapshot of the blocked slots, each slot is read only once. It is
+// too large for a signal stack, so there is only one, which is used by
+// one dump at a time.
+struct _dump_state
+{
+  _blocked_op ops[blocked::capacity];
+  const void* objects[blocked::capacity];
+  std::thread::id threads[blocked::capacity];
+  std::thread::id waits_for[blocked::capacity];
+  long os_tids[blocked::capacity];
+  std::int64_t sinces[blocked::capacity];
+  std::size_t next[blocked::capacity];
+  unsigned char color[blocked::capacity];
+};
+
+_dump_state _dump_buffers;
+std::atomic_flag _is_dumping = ATOMIC_FLAG_INIT;
+
+void _dump(_writer& out, _dump_state& state)
+{
+  const std::int64_t now = _now();
+
+  std::size_t n = 0;
+  _blocked_op* const ops = state.ops;
+  const void** const objects = state.objects;
+  std::thread::id* const threads = state.threads;
+  std::thread::id* const waits_for = state.waits_for;
+  long* const os_tids = state.os_tids;
+  std::int64_t* const sinces = state.sinces;
+
+  for (const _blocked_slot& slot : _slots)
+  {
+    if (!slot.used.load(std::memory_order_acquire))
+      continue;
+
+    const _blocked_op op = slot.op.load(std::memory_order_acquire);
+    if (op == _blocked_op::none)
+      continue;
+
+    ops[n] = op;
+    objects[n] = slot.object.load(std::memory_order_relaxed);
+    threads[n] = slot.thread.load(std::memory_order_relaxed);
+    waits_for[n] = slot.waits_for.load(std::memory_order_relaxed);
+    os_tids[n] = slot.os_tid.load(std::memory_order_relaxed);
+    sinces[n] = slot.since.load(std::memory_order_relaxed);
+    n++;
+  }
+
+  out << "cpp-channel: " << static_cast<std::uint64_t>(n) <<
+    " blocked thread(s)\n";
+  for (std::size_t i = 0; i < n; i++)
+  {
+    const std::int64_t ms = (now - sinces[i]) / 1000000;
+    out << "  thread " << static_cast<std::uint64_t>(os_tids[i]) << ' ' <<
+      _op_name(ops[i]) << objects[i] << " for " <<
+      static_cast<std::uint64_t>(ms < 0 ? 0 : ms) << " ms\n";
+  }
+
+  // Every blocked thread waits for at most one other blocked thread,
+  // so following these edges from each thread finds all cycles.
+  std::size_t* const next = state.next;
+  for (std::size_t i = 0; i < n; i++)
+  {
+    next[i] = n;
+    for (std::size_t j = 0; j < n && waits_for[i] != std::thread::id(); j++)
+    {
+      if (i != j && threads[j] == waits_for[i])
+      {
+        next[i] = j;
+        break;
+      }
+    }
+  }
+
+  // 0: unvisited, 1: on current path, 2: done
+  unsigned char* const color = state.color;
+  std::memset(color, 0, sizeof(state.color));
+  for (std::size_t i = 0; i < n; i++)
+  {
+    std::size_t j = i;
+    while (j < n && color[j] == 0)
+    {
+      color[j] = 1;
+      j = next[j];
+    }
+
+    // found a cycle through j that has not been reported yet
+    if (j < n && color[j] == 1)
+    {
+      out << "  wait-for cycle: thread " <<
+        static_cast<std::uint64_t>(os_tids[j]);
+      for (std::size_t k = next[j]; ; k = next[k])
+      {
+        out << " -> thread " << static_cast<std::uint64_t>(os_tids[k]);
+        if (k == j)
+          break;
+      }
+      out << '\n';
+    }
+
+    for (j = i; j < n && color[j] == 1; j = next[j])
+      color[j] = 2;
+  }
+}
+
+// Dumps unless another dump is in progress, e.g. in the thread that
+// has been interrupted by the signal handler
+void _try_dump(_writer& out)
+{
+  if (_is_dumping.test_and_set(std::memory_order_acquire))
+  {
+    out << "cpp-channel: another dump is in progress\n";
+    return;
+  }
+
+  _dump(out, _dump_buffers);
+  _is_dumping.clear(std::memory_order_release);
+}
+
+void _ostream_sink(void* context, const char* data, std::size_t size)
+{
+  static_cast<std::ostream*>(context)->write(data, size);
+}
+
+void _fd_sink(void* context, const char* data, std::size_t size)
+{
+  const int fd = *static_cast<int*>(context);
+  while (size)
+  {
+    const ssize_t written = ::write(fd, data, size);
+    if (written <= 0)
+      return;
+
+    data += written;
+    size -= written;
+  }
+}
+
+void _signal_handler(int)
+{
+  blocked::dump(STDERR_FILENO);
+}
+
+}
+
+_blocked_scope::_blocked_scope(const void* object, const _parties* parties,
+  _blocked_op op)
+: m_slot(nullptr)
+{
+  thread_local _slot_owner owner;
+  _blocked_slot* slot = owner.slot();
+  if (slot == nullptr)
+    return;
+
+  // copied because the channel can be gone by the time of a dump
+  std::thread::id waits_for;
+  if (parties && op == _blocked_op::send)
+    waits_for = parties->last_receiver.load(std::memory_order_relaxed);
+  else if (parties && op == _blocked_op::recv)
+    waits_for = parties->last_sender.load(std::memory_order_relaxed);
+
+  slot->object.store(object, std::memory_order_relaxed);
+  slot->waits_for.store(waits_for, std::memory_order_relaxed);
+  slot->since.store(_now(), std::memory_order_relaxed);
+  slot->op.store(op, std::memory_order_release);
+  m_slot = slot;
+}
+
+_blocked_scope::~_blocked_scope()
+{
+  if (m_slot)
+    static_cast<_blocked_slot*>(m_slot)->op.store(_blocked_op::none,
+      std::memory_order_release);
+}
+
+}
+
+namespace blocked
+{
+
+void dump(std::ostream& out)
+{
+  internal::_writer writer(internal::_ostream_sink, &out);
+  internal::_try_dump(writer);
+}
+
+void dump(int fd)
+{
+  internal::_writer writer(internal::_fd_sink, &fd);
+  internal::_try_dump(writer);
+}
+
+bool install_handler(int signum)
+{
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = internal::_signal_handler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  return 0 == sigaction(signum, &action, nullptr);
+}
+
+}
+
+}
@@ -0,0 +1,440 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_pipeline.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <algorithm>
+#include <exception>
+#include <condition_variable>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+constexpr std::size_t _max_batch = 1024;
+
+// every _sample_period-th element of a segment is timed
+constexpr std::size_t _sample_period = 64;
+
+// polls before an idle worker sleeps
+constexpr unsigned _idle_polls = 64;
+
+// Capacity of the channel that _make_link() builds between segments with
+// the given batches
+std::size_t _capacity(std::size_t producer_batch, std::size_t consumer_batch)
+{
+  return _link_capacity(std::min(_max_batch,
+    2 * std::max(producer_batch, consumer_batch)));
+}
+
+std::size_t _batch(double ns, double step_ns)
+{
+  if (ns < 0)
+    return 16;
+  if (ns * _max_batch <= step_ns)
+    return _max_batch;
+
+  return std::max<std::size_t>(1, static_cast<std::size_t>(step_ns / ns));
+}
+
+// A segment while the pipeline runs. A worker owns it during a step.
+struct _running_segment
+{
+  std::vector<_pipeline_stage*> stages;
+
+  // not owned, null for the first and the last segment, respectively
+  _link* in;
+  _link* out;
+
+  // values[0] is the input, values[i + 1] the output of stages[i]
+  std::vector<std::unique_ptr<_value>> values;
+
+  const std::size_t batch;
+  bool has_pending;
+  bool has_pending_end;
+  bool is_done;
+  std::size_t elements;
+
+  // sampled nanoseconds and elements per stage
+  std::vector<double> sampled_ns;
+  std::vector<std::size_t> samples;
+
+  std::atomic<bool> is_busy;
+
+  explicit _running_segment(std::size_t b)
+  : stages(),
+    in(nullptr),
+    out(nullptr),
+    values(),
+    batch(b),
+    has_pending(false),
+    has_pending_end(false),
+    is_done(false),
+    elements(0),
+    sampled_ns(),
+    samples(),
+    is_busy(false) {}
+
+  // Runs stages[i], and times it for sampled elements
+  bool apply(std::size_t i, bool is_sampled)
+  {
+    if (!is_sampled)
+      return stages[i]->apply(*values[i], *values[i + 1]);
+
+    const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    const bool has_output = stages[i]->apply(*values[i], *values[i + 1]);
+    sampled_ns[i] += std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+    samples[i]++;
+    return has_output;
+  }
+
+  // Processes up to a batch of elements, returns whether it moved any
+  // \pre the calling worker owns the segment
+  bool step()
+  {
+    bool has_progress = false;
+    for (std::size_t n = 0; n < batch && !is_done;)
+    {
+      if (has_pending)
+      {
+        if (!out->try_push(*values.back()))
+          return has_progress;
+
+        has_pending = false;
+        has_progress = true;
+        continue;
+      }
+
+      if (has_pending_end)
+      {
+        if (!out->try_push_end())
+          return has_progress;
+
+        has_pending_end = false;
+        is_done = true;
+        return true;
+      }
+
+      const bool is_sampled = elements % _sample_period == 0;
+      std::size_t i = 0;
+      if (in == nullptr)
+      {
+        // the source
+        if (!apply(i++, is_sampled))
+        {
+          has_pending_end = out != nullptr;
+          is_done = out == nullptr;
+          has_progress = true;
+          continue;
+        }
+      }
+      else
+      {
+        const _pop_result r = in->try_pop(*values[0]);
+        if (r == _pop_result::empty)
+          return has_progress;
+
+        if (r == _pop_result::end)
+        {
+          has_pending_end = out != nullptr;
+          is_done = out == nullptr;
+          has_progress = true;
+          continue;
+        }
+      }
+
+      has_progress = true;
+      elements++;
+      n++;
+
+      bool has_output = true;
+      for (; has_output && i < stages.size(); i++)
+        has_output = apply(i, is_sampled);
+
+      has_pending = has_output && out != nullptr;
+    }
+    return has_progress;
+  }
+};
+
+class _pipeline_run
+{
+private:
+  std::vector<std::unique_ptr<_link>> m_links;
+  std::vector<std::unique_ptr<_running_segment>> m_segments;
+  std::atomic<std::size_t> m_done;
+  std::atomic<bool> m_is_aborted;
+
+  // first exception thrown by a stage
+  std::mutex m_error_mutex;
+  std::exception_ptr m_error;
+
+  // Eventcount on which idle workers sleep until a step moves elements
+  std::atomic<std::uint64_t> m_epoch;
+  std::atomic<unsigned> m_sleepers;
+  std::mutex m_park_mutex;
+  std::condition_variable m_park_cv;
+
+  bool is_finished() const
+  {
+    return m_done.load() == m_segments.size() || m_is_aborted.load();
+  }
+
+  void notify()
+  {
+    m_epoch.fetch_add(1);
+    if (m_sleepers.load() == 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(m_park_mutex);
+    m_park_cv.notify_all();
+  }
+
+  // Sleeps until some step moves elements after epoch was read
+  void park(std::uint64_t epoch)
+  {
+    std::unique_lock<std::mutex> lock(m_park_mutex);
+    m_sleepers.fetch_add(1);
+    m_park_cv.wait(lock, [this, epoch]{
+      return m_epoch.load() != epoch || is_finished(); });
+    m_sleepers.fetch_sub(1);
+  }
+
+public:
+  _pipeline_run(const _stages& stages,
+    const std::vector<pipeline::segment>& plan)
+  : m_links(),
+    m_segments(),
+    m_done(0),
+    m_is_aborted(false),
+    m_error_mutex(),
+    m_error(),
+    m_epoch(0),
+    m_sleepers(0),
+    m_park_mutex(),
+    m_park_cv()
+  {
+    std::size_t next = 0;
+    for (const pipeline::segment& s : plan)
+    {
+      m_segments.push_back(make_unique<_running_segment>(s.batch));
+      _running_segment& running = *m_segments.back();
+
+      // the source has no input, but a slot keeps the indices uniform
+      running.values.push_back(next == 0 ? make_unique<_value>() :
+        stages[next - 1]->make_slot());
+      if (!m_links.empty())
+        running.in = m_links.back().get();
+
+      for (std::size_t k = 0; k < s.stages.size(); k++, next++)
+      {
+        running.stages.push_back(stages[next].get());
+        running.values.push_back(stages[next]->make_slot());
+      }
+      running.sampled_ns.assign(running.stages.size(), 0);
+      running.samples.assign(running.stages.size(), 0);
+
+      if (s.capacity > 0)
+      {
+        m_links.push_back(stages[next - 1]->make_link(s.capacity));
+        running.out = m_links.back().get();
+      }
+    }
+  }
+
+  // Steps through the segments round-robin, starting at first
+  void work(std::size_t first)
+  {
+    const std::size_t n = m_segments.size();
+    for (unsigned idle = 0; !is_finished();)
+    {
+      const std::uint64_t epoch = m_epoch.load();
+      bool has_progress = false;
+      for (std::size_t k = 0; k < n && !m_is_aborted.load(); k++)
+      {
+        _running_segment& s = *m_segments[(first + k) % n];
+        if (s.is_busy.exchange(true, std::memory_order_acquire))
+          continue;
+
+        if (!s.is_done)
+        {
+          try
+          {
+            if (s.step())
+            {
+              has_progress = true;
+              if (s.is_done)
+                m_done.fetch_add(1);
+            }
+          }
+          catch (...)
+          {
+            s.is_busy.store(false, std::memory_order_release);
+            abort(std::current_exception());
+            return;
+          }
+        }
+        s.is_busy.store(false, std::memory_order_release);
+      }
+
+      if (has_progress)
+      {
+        idle = 0;
+        notify();
+      }
+      else if (++idle < _idle_polls)
+        std::this_thread::yield();
+      else
+        park(epoch);
+    }
+  }
+
+  // Stops all workers after their current step
+  void abort(std::exception_ptr error)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_error_mutex);
+      if (!m_error)
+        m_error = error;
+    }
+    m_is_aborted.store(true);
+    notify();
+  }
+
+  void rethrow()
+  {
+    if (m_error)
+      std::rethrow_exception(m_error);
+  }
+
+  // Nanoseconds per element by stage name
+  void measured(std::map<std::string, double>& costs) const
+  {
+    for (const std::unique_ptr<_running_segment>& s : m_segments)
+    {
+      for (std::size_t i = 0; i < s->stages.size(); i++)
+      {
+        if (s->samples[i] > 0)
+          costs[s->stages[i]->name] = s->sampled_ns[i] / s->samples[i];
+      }
+    }
+  }
+};
+
+}
+
+}
+
+pipeline::pipeline(internal::_stages stages, const pipeline_options& options)
+: m_stages(std::move(stages)),
+  m_segments(),
+  m_measured()
+{
+  // unknown costs are infinite
+  const double infinity = std::numeric_limits<double>::infinity();
+  std::vector<double> costs;
+  for (const std::shared_ptr<internal::_pipeline_stage>& s : m_stages)
+  {
+    const auto measured = options.profile.find(s->name);
+    const double ns = measured != options.profile.end() ?
+      measured->second : s->hint.ns;
+    costs.push_back(ns < 0 ? infinity : ns);
+  }
+
+  std::vector<double> segment_costs;
+  for (std::size_t i = 0; i < m_stages.size(); i++)
+  {
+    const bool is_fused = i > 0 && !m_stages[i - 1]->hint.is_stateful &&
+      !m_stages[i]->hint.is_stateful &&
+      std::min(segment_costs.back(), costs[i]) <= options.hop_ns;
+
+    if (is_fused)
+    {
+      m_segments.back().stages.push_back(m_stages[i]->name);
+      segment_costs.back() += costs[i];
+    }
+    else
+    {
+      m_segments.push_back(segment{{m_stages[i]->name}, 0, 0, 0});
+      segment_costs.push_back(costs[i]);
+    }
+  }
+
+  for (std::size_t k = 0; k < m_segments.size(); k++)
+  {
+    const double ns = segment_costs[k];
+    m_segments[k].ns = ns == infinity ? -1 : ns;
+    m_segments[k].batch = internal::_batch(m_segments[k].ns, options.step_ns);
+  }
+  for (std::size_t k = 0; k + 1 < m_segments.size(); k++)
+    m_segments[k].capacity = internal::_capacity(m_segments[k].batch,
+      m_segments[k + 1].batch);
+}
+
+void pipeline::write(std::ostream& out) const
+{
+  for (std::size_t k = 0; k < m_segments.size(); k++)
+  {
+    const segment& s = m_segments[k];
+    out << "segment " << k << ':';
+    for (const std::string& stage : s.stages)
+      out << ' ' << stage;
+
+    out << " (";
+    if (s.ns < 0)
+      out << "unknown cost";
+    else
+      out << s.ns << " ns";
+    out << ", batch " << s.batch << ')';
+
+    if (s.capacity > 0)
+      out << " -> channel of " << s.capacity;
+    out << '\n';
+  }
+}
+
+void pipeline::run(unsigned workers)
+{
+  if (workers == 0)
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  workers = std::min(workers, static_cast<unsigned>(m_segments.size()));
+
+  internal::_pipeline_run r(m_stages, m_segments);
+  std::vector<std::thread> threads;
+  try
+  {
+    for (unsigned w = 1; w < workers; w++)
+      threads.emplace_back([&r, w] { r.work(w); });
+  }
+  catch (...)
+  {
+    r.abort(std::current_exception());
+    for (std::thread& thread : threads)
+      thread.join();
+    throw;
+  }
+
+  r.work(0);
+  for (std::thread& thread : threads)
+    thread.join();
+
+  m_measured.clear();
+  r.measured(m_measured);
+  r.rethrow();
+}
+
+}
@@ -0,0 +1,362 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_placement.h>
+
+#include <map>
+#include <tuple>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Parses a CPU list such as "0-3,8,10-11", returns false if malformed
+bool _parse_cpu_list(const std::string& s, std::vector<int>& cpus)
+{
+  std::istringstream in(s);
+  std::string range;
+  while (std::getline(in, range, ','))
+  {
+    int first, last;
+    char dash;
+    std::istringstream r(range);
+    if (!(r >> first))
+      return false;
+
+    last = first;
+    if (r >> dash && (dash != '-' || !(r >> last)))
+      return false;
+
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return true;
+}
+
+// Contents of a sysfs file without its trailing newline, or false
+bool _read_line(const std::string& path, std::string& line)
+{
+  std::ifstream in(path);
+  return static_cast<bool>(std::getline(in, line));
+}
+
+// Integer in a sysfs file, or -1
+int _read_int(const std::string& path)
+{
+  std::string line;
+  int n;
+  if (!_read_line(path, line) || !(std::istringstream(line) >> n))
+    return -1;
+
+  return n;
+}
+
+// Lowest CPU in a CPU list file, which identifies the group of CPUs
+// that the list names, or -1
+int _read_group(const std::string& path)
+{
+  std::string line;
+  std::vector<int> cpus;
+  if (!_read_line(path, line) || !_parse_cpu_list(line, cpus) ||
+      cpus.empty())
+    return -1;
+
+  return *std::min_element(cpus.begin(), cpus.end());
+}
+
+placement::cpu _read_cpu(const std::string& root, int id)
+{
+  const std::string dir(root + "/cpu" + std::to_string(id));
+  placement::cpu c{id, -1, -1, -1, -1};
+
+  c.core = _read_group(dir + "/topology/core_cpus_list");
+  if (c.core == -1)
+    c.core = _read_group(dir + "/topology/thread_siblings_list");
+  c.package = _read_int(dir + "/topology/physical_package_id");
+
+  for (unsigned i = 0;; i++)
+  {
+    const std::string index(dir + "/cache/index" + std::to_string(i));
+    const int level = _read_int(index + "/level");
+    if (level == -1)
+      break;
+
+    if (level == 2)
+      c.l2 = _read_group(index + "/shared_cpu_list");
+    else if (level == 3)
+      c.l3 = _read_group(index + "/shared_cpu_list");
+  }
+  return c;
+}
+
+// Returns false if and only if thread could not be pinned to cpu
+bool _pin(std::thread::native_handle_type thread, int cpu)
+{
+#ifdef __linux__
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return false;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+  (void)thread;
+  (void)cpu;
+  return false;
+#endif
+}
+
+// Orders CPUs such that neighbours are close. Within a package and an
+// L3 cache, every core gets one thread before any core gets two, so
+// that neighbouring stages share a cache but not an execution unit.
+std::vector<placement::cpu> _locality_order(
+  const std::vector<placement::cpu>& cpus)
+{
+  std::map<int, unsigned> siblings;
+  std::vector<std::tuple<int, int, unsigned, int, int, int>> keys;
+  for (const placement::cpu& c : cpus)
+  {
+    const unsigned rank = c.core == -1 ? 0 : siblings[c.core]++;
+    keys.emplace_back(c.package, c.l3, rank, c.l2, c.core, c.id);
+  }
+  std::vector<std::size_t> order(cpus.size());
+  for (std::size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+    [&keys](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+
+  std::vector<placement::cpu> sorted;
+  for (std::size_t i : order)
+    sorted.push_back(cpus[i]);
+  return sorted;
+}
+
+// Orders stages greedily, such that each stage communicates most with
+// the one before it
+std::vector<std::size_t> _stage_order(const placement::graph& g)
+{
+  const std::size_t n = g.stages().size();
+  std::vector<std::vector<double>> weights(n, std::vector<double>(n, 0));
+  std::vector<double> totals(n, 0);
+  for (const placement::graph::edge_info& e : g.edges())
+  {
+    if (e.from == e.to)
+      continue;
+
+    weights[e.from][e.to] += e.weight;
+    weights[e.to][e.from] += e.weight;
+    totals[e.from] += e.weight;
+    totals[e.to] += e.weight;
+  }
+
+  std::vector<std::size_t> order;
+  std::vector<bool> is_placed(n, false);
+  std::vector<double> to_placed(n, 0);
+  while (order.size() < n)
+  {
+    // by weight to the last stage, then to all placed stages, then
+    // in total; ties go to the lowest id
+    std::size_t best = n;
+    for (std::size_t s = 0; s < n; s++)
+    {
+      if (is_placed[s])
+        continue;
+
+      if (best == n)
+      {
+        best = s;
+        continue;
+      }
+
+      const double last = order.empty() ? 0 : weights[order.back()][s];
+      const double best_last = order.empty() ? 0 :
+        weights[order.back()][best];
+      if (std::make_tuple(last, to_placed[s], totals[s]) >
+          std::make_tuple(best_last, to_placed[best], totals[best]))
+        best = s;
+    }
+
+    order.push_back(best);
+    is_placed[best] = true;
+    for (std::size_t s = 0; s < n; s++)
+      to_placed[s] += weights[best][s];
+  }
+  return order;
+}
+
+}
+
+}
+
+namespace placement
+{
+
+sharing shared(const cpu& a, const cpu& b)
+{
+  if (a.id == b.id)
+    return sharing::same_cpu;
+  if (a.core != -1 && a.core == b.core)
+    return sharing::core;
+  if (a.l2 != -1 && a.l2 == b.l2)
+    return sharing::l2;
+  if (a.l3 != -1 && a.l3 == b.l3)
+    return sharing::l3;
+  if (a.package != -1 && a.package == b.package)
+    return sharing::package;
+
+  return sharing::none;
+}
+
+const char* to_string(sharing s)
+{
+  switch (s)
+  {
+  case sharing::same_cpu:
+    return "same cpu";
+  case sharing::core:
+    return "core";
+  case sharing::l2:
+    return "l2";
+  case sharing::l3:
+    return "l3";
+  case sharing::package:
+    return "package";
+  case sharing::none:
+    return "none";
+  }
+  return "unknown";
+}
+
+machine::machine(const std::string& root)
+: m_cpus()
+{
+  std::string online;
+  std::vector<int> ids;
+  if (!internal::_read_line(root + "/online", online) ||
+      !internal::_parse_cpu_list(online, ids) || ids.empty())
+    throw std::runtime_error("cpp::placement::machine: no CPUs in " + root);
+
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  for (int id : ids)
+    m_cpus.push_back(internal::_read_cpu(root, id));
+}
+
+machine machine::allowed() const
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    return *this;
+
+  std::vector<cpu> cpus;
+  for (const cpu& c : m_cpus)
+  {
+    if (c.id >= 0 && c.id < CPU_SETSIZE && CPU_ISSET(c.id, &set))
+      cpus.push_back(c);
+  }
+  if (!cpus.empty())
+    return machine(std::move(cpus));
+#endif
+  return *this;
+}
+
+std::size_t graph::stage(const std::string& name, unsigned threads)
+{
+  m_stages.push_back(stage_info{name, std::max(1u, threads)});
+  return m_stages.size() - 1;
+}
+
+void graph::edge(std::size_t from, std::size_t to, double weight)
+{
+  if (from >= m_stages.size() || to >= m_stages.size())
+    throw std::out_of_range("cpp::placement::graph::edge");
+
+  m_edges.push_back(edge_info{from, to, weight});
+}
+
+const cpu& plan::at(std::size_t stage, unsigned thread) const
+{
+  return m_cpus.at(stage).at(thread);
+}
+
+bool plan::pin(std::size_t stage, unsigned thread) const
+{
+#ifdef __linux__
+  return internal::_pin(pthread_self(), at(stage, thread).id);
+#else
+  at(stage, thread);
+  return false;
+#endif
+}
+
+bool plan::pin(std::thread& t, std::size_t stage, unsigned thread) const
+{
+  return internal::_pin(t.native_handle(), at(stage, thread).id);
+}
+
+void plan::write(std::ostream& out) const
+{
+  const std::vector<graph::stage_info>& stages = m_graph.stages();
+  for (std::size_t s = 0; s < stages.size(); s++)
+  {
+    for (std::size_t t = 0; t < m_cpus[s].size(); t++)
+    {
+      const cpu& c = m_cpus[s][t];
+      out << stages[s].name << '/' << t << ": cpu " << c.id << " (core " <<
+        c.core << ", l2 " << c.l2 << ", l3 " << c.l3 << ", package " <<
+        c.package << ")\n";
+    }
+  }
+
+  // the farthest apart pair of threads of the two stages
+  for (const graph::edge_info& e : m_graph.edges())
+  {
+    sharing farthest = sharing::same_cpu;
+    for (const cpu& a : m_cpus[e.from])
+    {
+      for (const cpu& b : m_cpus[e.to])
+        farthest = std::max(farthest, shared(a, b));
+    }
+    out << stages[e.from].name << " -> " << stages[e.to].name << ": " <<
+      to_string(farthest) << " (weight " << e.weight << ")\n";
+  }
+}
+
+plan place(const graph& g, const machine& m)
+{
+  if (m.cpus().empty())
+    throw std::invalid_argument("cpp::placement::place: no CPUs");
+
+  const std::vector<cpu> cpus(internal::_locality_order(m.cpus()));
+  std::vector<std::vector<cpu>> placed(g.stages().size());
+
+  std::size_t next = 0;
+  for (std::size_t s : internal::_stage_order(g))
+  {
+    for (unsigned t = 0; t < g.stages()[s].threads; t++)
+      placed[s].push_back(cpus[next++ % cpus.size()]);
+  }
+  return plan(g, std::move(placed));
+}
+
+}
+
+}
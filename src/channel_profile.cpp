@@ -0,0 +1,310 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_profile.h>
+
+#include <map>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+struct _stage
+{
+  std::mutex mutex;
+  unsigned threads;
+  long long wall_ns;
+  long long busy_ns;
+  long long input_blocked_ns;
+  long long output_blocked_ns;
+
+  _stage()
+  : mutex(),
+    threads(0),
+    wall_ns(0),
+    busy_ns(0),
+    input_blocked_ns(0),
+    output_blocked_ns(0) {}
+};
+
+namespace
+{
+
+struct _profile_state
+{
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<_stage>> stages;
+};
+
+_profile_state& _state()
+{
+  static _profile_state state;
+  return state;
+}
+
+// When profile::start() was last called
+std::atomic<long long> _started_ns(0);
+
+// Calling thread's stage and its blocked times until its scope ends,
+// counted since started_ns
+struct _profile_thread
+{
+  _stage* stage;
+  long long block_start_ns;
+  long long input_blocked_ns;
+  long long output_blocked_ns;
+  long long started_ns;
+};
+
+thread_local _profile_thread _thread = {nullptr, -1, 0, 0, 0};
+
+long long _now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long _cpu_ns()
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Forgets the blocked times from before the last profile::start()
+void _sync(_profile_thread& thread)
+{
+  const long long started_ns = _started_ns.load();
+  if (thread.started_ns == started_ns)
+    return;
+
+  thread.block_start_ns = -1;
+  thread.input_blocked_ns = 0;
+  thread.output_blocked_ns = 0;
+  thread.started_ns = started_ns;
+}
+
+}
+
+void _profile_record(_event e)
+{
+  _profile_thread& thread = _thread;
+  if (thread.stage == nullptr)
+    return;
+
+  _sync(thread);
+  switch (e)
+  {
+  case _event::send_block:
+  case _event::recv_block:
+    // a send can block twice, first for space and then for a receiver
+    if (thread.block_start_ns < 0)
+      thread.block_start_ns = _now_ns();
+    break;
+  case _event::send_end:
+    if (thread.block_start_ns >= 0)
+      thread.output_blocked_ns += _now_ns() - thread.block_start_ns;
+    thread.block_start_ns = -1;
+    break;
+  case _event::recv_end:
+    if (thread.block_start_ns >= 0)
+      thread.input_blocked_ns += _now_ns() - thread.block_start_ns;
+    thread.block_start_ns = -1;
+    break;
+  default:
+    break;
+  }
+}
+
+}
+
+namespace profile
+{
+
+void start()
+{
+  internal::_started_ns.store(internal::_now_ns());
+  internal::_profile_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const auto& stage : state.stages)
+    {
+      std::lock_guard<std::mutex> stage_lock(stage.second->mutex);
+      stage.second->threads = 0;
+      stage.second->wall_ns = 0;
+      stage.second->busy_ns = 0;
+      stage.second->input_blocked_ns = 0;
+      stage.second->output_blocked_ns = 0;
+    }
+  }
+  internal::_hook_mask.fetch_or(internal::_hook_profile);
+}
+
+void stop()
+{
+  internal::_hook_mask.fetch_and(~internal::_hook_profile);
+}
+
+bool is_started()
+{
+  return internal::_hook_mask.load() & internal::_hook_profile;
+}
+
+stage_scope::stage_scope(const std::string& name)
+: m_stage(nullptr),
+  m_outer(internal::_thread.stage),
+  m_outer_input_blocked_ns(internal::_thread.input_blocked_ns),
+  m_outer_output_blocked_ns(internal::_thread.output_blocked_ns),
+  m_outer_started_ns(internal::_thread.started_ns),
+  m_start_ns(internal::_now_ns()),
+  m_start_cpu_ns(internal::_cpu_ns())
+{
+  internal::_profile_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    std::shared_ptr<internal::_stage>& stage = state.stages[name];
+    if (!stage)
+      stage = std::make_shared<internal::_stage>();
+
+    // stages are never erased, so the pointer stays valid
+    m_stage = stage.get();
+  }
+
+  internal::_profile_thread& thread = internal::_thread;
+  thread.stage = m_stage;
+  thread.block_start_ns = -1;
+  thread.input_blocked_ns = 0;
+  thread.output_blocked_ns = 0;
+  thread.started_ns = internal::_started_ns.load();
+}
+
+stage_scope::~stage_scope()
+{
+  internal::_profile_thread& thread = internal::_thread;
+
+  // Like blocked time, wall and CPU time only count while profiling,
+  // and only since the last start(). The CPU time before start() is
+  // unknown, so it is assumed to be spread evenly over the scope.
+  if (is_started())
+  {
+    internal::_sync(thread);
+    const long long now_ns = internal::_now_ns();
+    const long long from_ns = std::max(m_start_ns, thread.started_ns);
+    const long long wall_ns = now_ns - from_ns;
+    long long busy_ns = internal::_cpu_ns() - m_start_cpu_ns;
+    if (from_ns > m_start_ns)
+      busy_ns = static_cast<long long>(static_cast<double>(busy_ns) *
+        wall_ns / (now_ns - m_start_ns));
+
+    std::lock_guard<std::mutex> lock(m_stage->mutex);
+    m_stage->threads++;
+    m_stage->wall_ns += wall_ns;
+    m_stage->busy_ns += busy_ns;
+    m_stage->input_blocked_ns += thread.input_blocked_ns;
+    m_stage->output_blocked_ns += thread.output_blocked_ns;
+  }
+
+  // Nested scopes account their time to both stages, but blocked
+  // time only to the innermost one
+  thread.stage = m_outer;
+  thread.block_start_ns = -1;
+  thread.input_blocked_ns = m_outer_input_blocked_ns;
+  thread.output_blocked_ns = m_outer_output_blocked_ns;
+  thread.started_ns = m_outer_started_ns;
+}
+
+report summarize()
+{
+  report r;
+  r.bottleneck = 0;
+  r.gain = 1;
+
+  internal::_profile_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const auto& entry : state.stages)
+    {
+      const internal::_stage& s = *entry.second;
+      std::lock_guard<std::mutex> stage_lock(entry.second->mutex);
+      if (s.threads == 0)
+        continue;
+
+      r.stages.push_back(stage{entry.first, s.threads, s.wall_ns * 1e-9,
+        s.busy_ns * 1e-9, s.input_blocked_ns * 1e-9,
+        s.output_blocked_ns * 1e-9});
+    }
+  }
+
+  if (r.stages.empty())
+    return r;
+
+  for (std::size_t i = 1; i < r.stages.size(); i++)
+  {
+    if (r.stages[i].utilization() > r.stages[r.bottleneck].utilization())
+      r.bottleneck = i;
+  }
+
+  // Stage i can sustain at most 1 / u_i times the current throughput.
+  // One more thread raises this bound of the bottleneck by (w + 1) / w,
+  // until the next busiest stage becomes the bottleneck.
+  const stage& b = r.stages[r.bottleneck];
+  double next = 0;
+  for (std::size_t i = 0; i < r.stages.size(); i++)
+  {
+    if (i != r.bottleneck)
+      next = std::max(next, r.stages[i].utilization());
+  }
+
+  r.gain = static_cast<double>(b.threads + 1) / b.threads;
+  if (next > 0)
+    r.gain = std::min(r.gain, b.utilization() / next);
+  r.gain = std::max(r.gain, 1.0);
+  return r;
+}
+
+void write(std::ostream& out)
+{
+  const report r(summarize());
+  const std::ios_base::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+
+  out << std::left << std::setw(20) << "stage" << std::right <<
+    std::setw(8) << "threads" << std::setw(10) << "wall/s" <<
+    std::setw(10) << "busy/s" << std::setw(10) << "input/s" <<
+    std::setw(10) << "output/s" << std::setw(8) << "util" << '\n';
+
+  out << std::fixed << std::setprecision(3);
+  for (const stage& s : r.stages)
+  {
+    out << std::left << std::setw(20) << s.name << std::right <<
+      std::setw(8) << s.threads << std::setw(10) << s.wall <<
+      std::setw(10) << s.busy << std::setw(10) << s.input_blocked <<
+      std::setw(10) << s.output_blocked << std::setw(7) <<
+      std::setprecision(0) << 100 * s.utilization() << '%' <<
+      std::setprecision(3) << '\n';
+  }
+
+  if (!r.stages.empty())
+  {
+    out << "bottleneck: " << r.stages[r.bottleneck].name <<
+      "; one more thread would raise throughput by up to " <<
+      std::setprecision(2) << r.gain << "x\n";
+  }
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}
+
+}
@@ -0,0 +1,380 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_record.h>
+#include <channel_trace.h>
+
+#include <map>
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+const char _magic[] = {'C', 'P', 'P', 'C', 'H', 'R', 'E', 'C'};
+const std::uint64_t _version = 1;
+
+struct _record_entry
+{
+  std::uint64_t time;
+  const void* channel;
+  record::operation op;
+  std::uint32_t size;
+  std::string payload;
+};
+
+// Recording of one thread. The mutex is only contended while the
+// recording is written or cleared.
+struct _record_thread
+{
+  std::mutex mutex;
+  std::vector<_record_entry> entries;
+
+  // only accessed by the owning thread
+  const void* pending_channel;
+  std::string pending_payload;
+
+  // has the thread exited?
+  std::atomic<bool> is_exited;
+
+  _record_thread()
+  : mutex(),
+    entries(),
+    pending_channel(nullptr),
+    pending_payload(),
+    is_exited(false) {}
+};
+
+struct _record_state
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<_record_thread>> threads;
+  std::atomic<long long> start_ns;
+
+  _record_state()
+  : mutex(),
+    threads(),
+    start_ns(0) {}
+};
+
+_record_state& _state()
+{
+  static _record_state state;
+  return state;
+}
+
+// Marks the recording of the calling thread when the thread exits
+struct _local_record
+{
+  std::shared_ptr<_record_thread> thread;
+
+  ~_local_record()
+  {
+    if (thread)
+      thread->is_exited.store(true, std::memory_order_release);
+  }
+};
+
+// Registers the calling thread's recording on first use. Recordings
+// outlive their threads so that they can be written after joining,
+// until the next record::start() frees them.
+_record_thread& _local_thread()
+{
+  thread_local _local_record local;
+  if (!local.thread)
+  {
+    _record_state& state = _state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    local.thread = std::make_shared<_record_thread>();
+    state.threads.push_back(local.thread);
+  }
+  return *local.thread;
+}
+
+long long _now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void _write_varint(std::ostream& out, std::uint64_t n)
+{
+  while (n >= 0x80)
+  {
+    out.put(static_cast<char>((n & 0x7f) | 0x80));
+    n >>= 7;
+  }
+  out.put(static_cast<char>(n));
+}
+
+void _write_bytes(std::ostream& out, const std::string& s)
+{
+  _write_varint(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+void _malformed()
+{
+  throw std::runtime_error("cpp::record: malformed recording");
+}
+
+std::uint64_t _read_varint(std::istream& in)
+{
+  std::uint64_t n = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7)
+  {
+    const int c = in.get();
+    if (c == std::istream::traits_type::eof())
+      _malformed();
+
+    n |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+    if ((c & 0x80) == 0)
+      return n;
+  }
+  _malformed();
+  return 0;
+}
+
+std::string _read_bytes(std::istream& in)
+{
+  const std::uint64_t size = _read_varint(in);
+  std::string s;
+
+  // grows with the data that is actually there, so that a corrupt
+  // length cannot exhaust memory
+  char buffer[4096];
+  for (std::uint64_t left = size; left > 0;)
+  {
+    const std::streamsize n = static_cast<std::streamsize>(
+      std::min<std::uint64_t>(left, sizeof(buffer)));
+    if (!in.read(buffer, n))
+      _malformed();
+
+    s.append(buffer, n);
+    left -= n;
+  }
+  return s;
+}
+
+}
+
+void _record_event(_event e, const void* object, std::size_t size)
+{
+  if (e == _event::withdraw)
+  {
+    // the element was never sent, so its send is forgotten
+    _record_thread& thread = _local_thread();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    for (auto iter = thread.entries.rbegin(); iter != thread.entries.rend();
+         ++iter)
+    {
+      if (iter->channel == object && iter->op == record::operation::send)
+      {
+        thread.entries.erase(std::next(iter).base());
+        break;
+      }
+    }
+    return;
+  }
+
+  if (e != _event::enqueue && e != _event::dequeue)
+    return;
+
+  const long long start_ns = _state().start_ns.load(std::memory_order_relaxed);
+  _record_thread& thread = _local_thread();
+
+  _record_entry entry = {static_cast<std::uint64_t>(
+    std::max(_now_ns() - start_ns, 0LL)), object, e == _event::enqueue ?
+    record::operation::send : record::operation::recv,
+    static_cast<std::uint32_t>(size), std::string()};
+
+  if (e == _event::enqueue && thread.pending_channel == object)
+    entry.payload.swap(thread.pending_payload);
+  thread.pending_channel = nullptr;
+  thread.pending_payload.clear();
+
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  thread.entries.push_back(std::move(entry));
+}
+
+void _record_payload(const void* channel, std::string&& payload)
+{
+  _record_thread& thread = _local_thread();
+  thread.pending_channel = channel;
+  thread.pending_payload = std::move(payload);
+}
+
+bool _record_is_started()
+{
+  return record::is_started();
+}
+
+}
+
+namespace record
+{
+
+void start()
+{
+  internal::_record_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    // all their entries are cleared anyway
+    state.threads.erase(std::remove_if(state.threads.begin(),
+      state.threads.end(),
+      [](const std::shared_ptr<internal::_record_thread>& thread)
+      {
+        return thread->is_exited.load(std::memory_order_acquire);
+      }), state.threads.end());
+
+    for (const std::shared_ptr<internal::_record_thread>& thread :
+         state.threads)
+    {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+      thread->entries.clear();
+    }
+    state.start_ns.store(internal::_now_ns());
+  }
+  internal::_hook_mask.fetch_or(internal::_hook_record);
+}
+
+void stop()
+{
+  internal::_hook_mask.fetch_and(~internal::_hook_record);
+}
+
+bool is_started()
+{
+  return internal::_hook_mask.load() & internal::_hook_record;
+}
+
+void write(std::ostream& out)
+{
+  std::vector<internal::_record_entry> entries;
+  {
+    internal::_record_state& state = internal::_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const std::shared_ptr<internal::_record_thread>& thread :
+         state.threads)
+    {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+      entries.insert(entries.end(), thread->entries.begin(),
+        thread->entries.end());
+    }
+  }
+
+  std::stable_sort(entries.begin(), entries.end(),
+    [](const internal::_record_entry& a, const internal::_record_entry& b)
+    {
+      return a.time < b.time;
+    });
+
+  std::map<const void*, std::uint64_t> ids;
+  std::vector<const void*> channels;
+  for (const internal::_record_entry& entry : entries)
+  {
+    if (ids.insert(std::make_pair(entry.channel, channels.size())).second)
+      channels.push_back(entry.channel);
+  }
+
+  out.write(internal::_magic, sizeof(internal::_magic));
+  internal::_write_varint(out, internal::_version);
+  internal::_write_varint(out, channels.size());
+  for (const void* channel : channels)
+    internal::_write_bytes(out, internal::_trace_name(channel));
+
+  internal::_write_varint(out, entries.size());
+  std::uint64_t time = 0;
+  for (const internal::_record_entry& entry : entries)
+  {
+    internal::_write_varint(out, entry.time - time);
+    internal::_write_varint(out, ids[entry.channel]);
+    out.put(static_cast<char>(entry.op));
+    internal::_write_varint(out, entry.size);
+    internal::_write_bytes(out, entry.payload);
+    time = entry.time;
+  }
+}
+
+bool write(const std::string& path)
+{
+  std::ofstream out(path, std::ios::binary);
+  if (!out)
+    return false;
+
+  write(out);
+  out.close();
+  return static_cast<bool>(out);
+}
+
+replayer::replayer(const std::string& path)
+: m_channels(),
+  m_events()
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("cpp::record: cannot open " + path);
+
+  *this = replayer(in);
+}
+
+replayer::replayer(std::istream& in)
+: m_channels(),
+  m_events()
+{
+  char magic[sizeof(internal::_magic)];
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), internal::_magic))
+    internal::_malformed();
+
+  if (internal::_read_varint(in) != internal::_version)
+    throw std::runtime_error("cpp::record: unsupported version");
+
+  const std::uint64_t channel_count = internal::_read_varint(in);
+  for (std::uint64_t i = 0; i < channel_count; i++)
+    m_channels.push_back(internal::_read_bytes(in));
+
+  const std::uint64_t event_count = internal::_read_varint(in);
+  std::uint64_t time = 0;
+  for (std::uint64_t i = 0; i < event_count; i++)
+  {
+    event e;
+    time += internal::_read_varint(in);
+    e.time = time;
+
+    const std::uint64_t channel = internal::_read_varint(in);
+    if (channel >= m_channels.size())
+      internal::_malformed();
+    e.channel = static_cast<std::uint32_t>(channel);
+
+    const int op = in.get();
+    if (op != static_cast<int>(operation::send) &&
+        op != static_cast<int>(operation::recv))
+      internal::_malformed();
+    e.op = static_cast<operation>(op);
+
+    e.size = static_cast<std::uint32_t>(internal::_read_varint(in));
+    e.payload = internal::_read_bytes(in);
+    m_events.push_back(std::move(e));
+  }
+}
+
+std::size_t replayer::find(const std::string& name) const
+{
+  return std::find(m_channels.begin(), m_channels.end(), name) -
+    m_channels.begin();
+}
+
+}
+
+}
@@ -0,0 +1,472 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_shard.h>
+#include <channel.h>
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Atomics that the producer and the consumer write are kept apart, so
+// that they do not share a cache line. Either end caches the index of
+// the other one, and only reloads it when the ring seems full or empty.
+struct _consumer_end
+{
+  std::atomic<std::size_t> head;
+  std::size_t cached_tail;
+  char padding[64];
+
+  _consumer_end()
+  : head(0),
+    cached_tail(0) {}
+};
+
+struct _producer_end
+{
+  std::atomic<std::size_t> tail;
+  std::size_t cached_head;
+  char padding[64];
+
+  _producer_end()
+  : tail(0),
+    cached_head(0) {}
+};
+
+// Bounded SPSC ring of tasks from one shard to another
+class _shard_ring
+{
+private:
+  const std::size_t m_capacity;
+  std::unique_ptr<shard_runtime::task[]> m_slots;
+  _consumer_end m_consumer;
+  _producer_end m_producer;
+
+public:
+  explicit _shard_ring(std::size_t capacity)
+  : m_capacity(capacity),
+    m_slots(new shard_runtime::task[capacity]),
+    m_consumer(),
+    m_producer() {}
+
+  // Producer only; moves from t if and only if it returns true
+  bool try_push(shard_runtime::task& t)
+  {
+    const std::size_t tail = m_producer.tail.load(std::memory_order_relaxed);
+    if (tail - m_producer.cached_head == m_capacity)
+    {
+      m_producer.cached_head = m_consumer.head.load(std::memory_order_acquire);
+      if (tail - m_producer.cached_head == m_capacity)
+        return false;
+    }
+
+    m_slots[tail % m_capacity] = std::move(t);
+    m_producer.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only
+  bool is_empty() const
+  {
+    return m_producer.tail.load(std::memory_order_acquire) ==
+      m_consumer.head.load(std::memory_order_relaxed);
+  }
+
+  // Consumer only; runs up to batch tasks, and frees their slots
+  // for the producer all at once
+  std::size_t run(std::size_t batch)
+  {
+    const std::size_t head = m_consumer.head.load(std::memory_order_relaxed);
+    if (head == m_consumer.cached_tail)
+    {
+      m_consumer.cached_tail = m_producer.tail.load(std::memory_order_acquire);
+      if (head == m_consumer.cached_tail)
+        return 0;
+    }
+
+    const std::size_t n = std::min(batch, m_consumer.cached_tail - head);
+    for (std::size_t i = 0; i < n; i++)
+    {
+      shard_runtime::task& slot = m_slots[(head + i) % m_capacity];
+      shard_runtime::task t(std::move(slot));
+      slot = nullptr;
+      t();
+    }
+
+    m_consumer.head.store(head + n, std::memory_order_release);
+    return n;
+  }
+};
+
+}
+
+struct _shard
+{
+  const shard_runtime* const runtime;
+  const unsigned index;
+  const std::size_t batch;
+  int cpu;
+
+  // indexed by shard; null for this shard itself
+  std::vector<_shard*> peers;
+  std::vector<std::unique_ptr<_shard_ring>> inbound;
+
+  // Tasks for peers whose ring was full, only accessed by the worker
+  std::vector<std::deque<shard_runtime::task>> overflow;
+  std::size_t overflowing;
+
+  // tasks that the worker submitted to itself
+  std::deque<shard_runtime::task> local;
+
+  // tasks from threads other than the workers
+  std::mutex inject_mutex;
+  std::vector<shard_runtime::task> injected;
+  std::atomic<bool> has_injected;
+
+  // An idle worker sleeps on park_cv
+  std::atomic<bool> is_sleeping;
+  std::atomic<bool> is_stopped;
+  std::mutex park_mutex;
+  std::condition_variable park_cv;
+
+  std::thread thread;
+
+  _shard(const shard_runtime* r, unsigned i, unsigned shards,
+    std::size_t capacity, std::size_t b)
+  : runtime(r),
+    index(i),
+    batch(b),
+    cpu(-1),
+    peers(shards, nullptr),
+    inbound(shards),
+    overflow(shards),
+    overflowing(0),
+    local(),
+    inject_mutex(),
+    injected(),
+    has_injected(false),
+    is_sleeping(false),
+    is_stopped(false),
+    park_mutex(),
+    park_cv(),
+    thread()
+  {
+    for (unsigned k = 0; k < shards; k++)
+    {
+      if (k != i)
+        inbound[k] = make_unique<_shard_ring>(capacity);
+    }
+  }
+
+  _shard_ring& ring_to(unsigned k)
+  {
+    return *peers[k]->inbound[index];
+  }
+
+  // Wakes the worker, if it sleeps. The caller must have made the
+  // new task visible before.
+  void wake()
+  {
+    // pairs with the fence in park()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!is_sleeping.load(std::memory_order_relaxed))
+      return;
+
+    // under the lock, so that the notification cannot slip in between
+    // the worker's last check for tasks and its wait
+    std::lock_guard<std::mutex> lock(park_mutex);
+    park_cv.notify_one();
+  }
+
+  // \pre called by the worker
+  bool has_tasks() const
+  {
+    if (has_injected.load(std::memory_order_acquire))
+      return true;
+
+    for (const std::unique_ptr<_shard_ring>& ring : inbound)
+    {
+      if (ring && !ring->is_empty())
+        return true;
+    }
+    return false;
+  }
+
+  void park()
+  {
+    std::unique_lock<std::mutex> lock(park_mutex);
+    is_sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    park_cv.wait(lock, [this]{
+      return is_stopped.load(std::memory_order_relaxed) || has_tasks(); });
+    is_sleeping.store(false, std::memory_order_relaxed);
+  }
+
+  // Moves as many overflowing tasks into their rings as fit
+  void flush()
+  {
+    for (unsigned k = 0; k < overflow.size() && overflowing > 0; k++)
+    {
+      std::deque<shard_runtime::task>& tasks = overflow[k];
+      if (tasks.empty())
+        continue;
+
+      _shard_ring& ring = ring_to(k);
+      std::size_t n = 0;
+      for (; !tasks.empty() && ring.try_push(tasks.front()); n++)
+        tasks.pop_front();
+
+      if (n > 0)
+      {
+        overflowing -= n;
+        peers[k]->wake();
+      }
+    }
+  }
+
+  // Runs tasks until stopped, \pre called by the worker
+  void run();
+};
+
+namespace
+{
+
+// shard of the calling thread, if it is a worker
+thread_local _shard* _this_shard = nullptr;
+
+// polls before an idle worker sleeps
+constexpr unsigned _idle_polls = 64;
+
+}
+
+void _shard::run()
+{
+  _this_shard = this;
+  std::vector<shard_runtime::task> tasks;
+  for (unsigned idle = 0; !is_stopped.load(std::memory_order_relaxed);)
+  {
+    std::size_t n = 0;
+
+    // tasks submitted during this loop run in the next round
+    for (std::size_t m = std::min(batch, local.size()); m > 0; m--, n++)
+    {
+      shard_runtime::task t(std::move(local.front()));
+      local.pop_front();
+      t();
+    }
+
+    for (const std::unique_ptr<_shard_ring>& ring : inbound)
+    {
+      if (ring)
+        n += ring->run(batch);
+    }
+
+    if (has_injected.load(std::memory_order_acquire))
+    {
+      {
+        std::lock_guard<std::mutex> lock(inject_mutex);
+        tasks.swap(injected);
+        has_injected.store(false, std::memory_order_relaxed);
+      }
+
+      for (shard_runtime::task& t : tasks)
+        t();
+      n += tasks.size();
+      tasks.clear();
+    }
+
+    if (overflowing > 0)
+      flush();
+
+    if (n > 0)
+      idle = 0;
+    else if (++idle < _idle_polls || overflowing > 0 || !local.empty())
+      std::this_thread::yield();
+    else
+      park();
+  }
+}
+
+namespace
+{
+
+// CPUs that the process may run on, in increasing order
+std::vector<int> _allowed_cpus()
+{
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+// Returns false if and only if thread could not be pinned to cpu
+bool _pin(std::thread& thread, int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(set),
+    &set) == 0;
+#else
+  (void)thread;
+  (void)cpu;
+  return false;
+#endif
+}
+
+}
+
+}
+
+shard_runtime::shard_runtime(unsigned shards, std::size_t capacity,
+  std::size_t batch)
+: m_shards()
+{
+  const std::vector<int> cpus(internal::_allowed_cpus());
+  if (shards == 0)
+  {
+    shards = static_cast<unsigned>(cpus.size());
+    if (shards == 0)
+      shards = std::max(1u, std::thread::hardware_concurrency());
+  }
+  capacity = std::max<std::size_t>(1, capacity);
+  batch = std::max<std::size_t>(1, batch);
+
+  for (unsigned i = 0; i < shards; i++)
+    m_shards.push_back(internal::make_unique<internal::_shard>(this, i,
+      shards, capacity, batch));
+
+  for (std::unique_ptr<internal::_shard>& shard : m_shards)
+  {
+    for (unsigned k = 0; k < shards; k++)
+    {
+      if (k != shard->index)
+        shard->peers[k] = m_shards[k].get();
+    }
+  }
+
+  try
+  {
+    for (std::unique_ptr<internal::_shard>& shard : m_shards)
+    {
+      internal::_shard* s = shard.get();
+      s->thread = std::thread([s] { s->run(); });
+
+      // more shards than CPUs share them round-robin
+      if (!cpus.empty())
+      {
+        const int cpu = cpus[s->index % cpus.size()];
+        if (internal::_pin(s->thread, cpu))
+          s->cpu = cpu;
+      }
+    }
+  }
+  catch (...)
+  {
+    _stop();
+    throw;
+  }
+}
+
+shard_runtime::~shard_runtime()
+{
+  _stop();
+}
+
+void shard_runtime::_stop()
+{
+  for (std::unique_ptr<internal::_shard>& shard : m_shards)
+  {
+    shard->is_stopped.store(true, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(shard->park_mutex);
+    shard->park_cv.notify_one();
+  }
+
+  for (std::unique_ptr<internal::_shard>& shard : m_shards)
+  {
+    if (shard->thread.joinable())
+      shard->thread.join();
+  }
+}
+
+unsigned shard_runtime::current() const
+{
+  const internal::_shard* s = internal::_this_shard;
+  return s != nullptr && s->runtime == this ? s->index : size();
+}
+
+int shard_runtime::cpu(unsigned shard) const
+{
+  if (shard >= size())
+    throw std::out_of_range("cpp::shard_runtime::cpu");
+
+  return m_shards[shard]->cpu;
+}
+
+void shard_runtime::submit_to(unsigned shard, task fn)
+{
+  if (shard >= size())
+    throw std::out_of_range("cpp::shard_runtime::submit_to");
+
+  internal::_shard& to = *m_shards[shard];
+  internal::_shard* from = internal::_this_shard;
+  if (from == nullptr || from->runtime != this)
+  {
+    {
+      std::lock_guard<std::mutex> lock(to.inject_mutex);
+      to.injected.push_back(std::move(fn));
+      to.has_injected.store(true, std::memory_order_release);
+    }
+    to.wake();
+    return;
+  }
+
+  if (from == &to)
+  {
+    to.local.push_back(std::move(fn));
+    return;
+  }
+
+  // behind earlier overflowing tasks, to keep the order
+  std::deque<task>& overflow = from->overflow[shard];
+  if (overflow.empty() && from->ring_to(shard).try_push(fn))
+  {
+    to.wake();
+    return;
+  }
+
+  overflow.push_back(std::move(fn));
+  from->overflowing++;
+}
+
+}
@@ -0,0 +1,423 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_topology.h>
+#include <channel_trace.h>
+
+#include <map>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Scaled by the sample period
+struct _edge
+{
+  std::uint64_t sent;
+  std::uint64_t received;
+  std::uint64_t send_blocked;
+  std::uint64_t recv_blocked;
+};
+
+// Counters of one thread. The mutex is only contended while the
+// graph is written.
+struct _topology_thread
+{
+  std::mutex mutex;
+  const unsigned id;
+  std::string name;
+  std::map<const void*, _edge> edges;
+
+  // state of the current operation
+  std::uint64_t tick;
+  bool is_sampled;
+  bool is_blocked;
+
+  // has the thread exited?
+  std::atomic<bool> is_exited;
+
+  explicit _topology_thread(unsigned i)
+  : mutex(),
+    id(i),
+    name(),
+    edges(),
+    tick(0),
+    is_sampled(true),
+    is_blocked(false),
+    is_exited(false) {}
+};
+
+struct _topology_state
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<_topology_thread>> threads;
+  unsigned next_id;
+  std::atomic<unsigned> sample_period;
+  std::chrono::steady_clock::time_point start_time;
+  std::chrono::steady_clock::time_point stop_time;
+
+  _topology_state()
+  : mutex(),
+    threads(),
+    next_id(1),
+    sample_period(1),
+    start_time(std::chrono::steady_clock::now()),
+    stop_time(start_time) {}
+};
+
+_topology_state& _state()
+{
+  static _topology_state state;
+  return state;
+}
+
+// Marks the counters of the calling thread when the thread exits
+struct _local_topology
+{
+  std::shared_ptr<_topology_thread> thread;
+
+  ~_local_topology()
+  {
+    if (thread)
+      thread->is_exited.store(true, std::memory_order_release);
+  }
+};
+
+// Registers the calling thread's counters on first use. They outlive
+// their thread so that the graph can be written after joining, until
+// the next topology::start() frees them.
+_topology_thread& _local_thread()
+{
+  thread_local _local_topology local;
+  if (!local.thread)
+  {
+    _topology_state& state = _state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    local.thread = std::make_shared<_topology_thread>(state.next_id++);
+    state.threads.push_back(local.thread);
+  }
+  return *local.thread;
+}
+
+// Aggregated view of all threads at one point in time
+struct _graph
+{
+  double seconds;
+  std::vector<std::pair<unsigned, std::string>> threads;
+  std::map<const void*, unsigned> channels;
+  std::vector<std::pair<unsigned, std::map<const void*, _edge>>> edges;
+};
+
+_graph _snapshot()
+{
+  _topology_state& state = _state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  _graph graph;
+  const std::chrono::steady_clock::time_point end =
+    topology::is_started() ? std::chrono::steady_clock::now() : state.stop_time;
+  graph.seconds = std::chrono::duration<double>(end - state.start_time).count();
+
+  for (const std::shared_ptr<_topology_thread>& thread : state.threads)
+  {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    if (thread->edges.empty())
+      continue;
+
+    graph.threads.emplace_back(thread->id, thread->name.empty() ?
+      "thread " + std::to_string(thread->id) : thread->name);
+    graph.edges.emplace_back(thread->id, thread->edges);
+    for (const std::pair<const void* const, _edge>& edge : thread->edges)
+      graph.channels.insert(std::make_pair(edge.first, graph.channels.size()));
+  }
+  return graph;
+}
+
+std::string _channel_label(const void* channel)
+{
+  std::string name(_trace_name(channel));
+  if (name.empty())
+  {
+    std::ostringstream out;
+    out << channel;
+    name = out.str();
+  }
+  return name;
+}
+
+double _ratio(std::uint64_t part, std::uint64_t whole)
+{
+  return whole ? static_cast<double>(part) / whole : 0.0;
+}
+
+void _write_dot_edge(std::ostream& out, const std::string& from,
+  const std::string& to, std::uint64_t messages, std::uint64_t blocked,
+  double seconds)
+{
+  const double blocked_ratio = _ratio(blocked, messages);
+  out << "  " << from << " -> " << to << " [label=\"" <<
+    static_cast<std::uint64_t>(seconds > 0 ? messages / seconds : 0) <<
+    " msg/s\\n" << static_cast<unsigned>(100 * blocked_ratio + 0.5) <<
+    "% blocked\"";
+  if (blocked_ratio >= 0.5)
+    out << ",color=red";
+  out << "];\n";
+}
+
+void _write_json_edge(std::ostream& out, const char* separator,
+  const std::string& from, const std::string& to, std::uint64_t messages,
+  std::uint64_t blocked, double seconds)
+{
+  out << separator << "{\"from\":\"" << from << "\",\"to\":\"" << to <<
+    "\",\"messages\":" << messages << ",\"messages_per_second\":" <<
+    (seconds > 0 ? messages / seconds : 0) << ",\"blocked\":" <<
+    _ratio(blocked, messages) << '}';
+}
+
+}
+
+void _topology_record(_event e, const void* object)
+{
+  const unsigned period = _state().sample_period.load(
+    std::memory_order_relaxed);
+
+  _topology_thread& thread = _local_thread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  switch (e)
+  {
+  case _event::send_begin:
+  case _event::recv_begin:
+  case _event::select_begin:
+    thread.is_sampled = 0 == thread.tick++ % period;
+    thread.is_blocked = false;
+    break;
+  case _event::send_block:
+  case _event::recv_block:
+    thread.is_blocked = true;
+    break;
+  case _event::enqueue:
+    if (thread.is_sampled)
+      thread.edges[object].sent += period;
+    break;
+  case _event::withdraw:
+    // same operation as the enqueue, and thus sampled alike, unless
+    // the counts were cleared in between
+    if (thread.is_sampled && thread.edges[object].sent >= period)
+      thread.edges[object].sent -= period;
+    break;
+  case _event::dequeue:
+    if (thread.is_sampled)
+      thread.edges[object].received += period;
+    break;
+  case _event::send_end:
+    if (thread.is_sampled && thread.is_blocked)
+      thread.edges[object].send_blocked += period;
+    thread.is_blocked = false;
+    break;
+  case _event::recv_end:
+    if (thread.is_sampled && thread.is_blocked)
+      thread.edges[object].recv_blocked += period;
+    thread.is_blocked = false;
+    break;
+  case _event::select_end:
+    break;
+  }
+}
+
+}
+
+namespace topology
+{
+
+void start(unsigned sample_period)
+{
+  internal::_topology_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    // all their counters are cleared anyway
+    state.threads.erase(std::remove_if(state.threads.begin(),
+      state.threads.end(),
+      [](const std::shared_ptr<internal::_topology_thread>& thread)
+      {
+        return thread->is_exited.load(std::memory_order_acquire);
+      }), state.threads.end());
+
+    for (const std::shared_ptr<internal::_topology_thread>& thread :
+         state.threads)
+    {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+      thread->edges.clear();
+      thread->tick = 0;
+    }
+    state.sample_period.store(sample_period ? sample_period : 1);
+    state.start_time = std::chrono::steady_clock::now();
+  }
+  internal::_hook_mask.fetch_or(internal::_hook_topology);
+}
+
+void stop()
+{
+  internal::_hook_mask.fetch_and(~internal::_hook_topology);
+
+  internal::_topology_state& state = internal::_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.stop_time = std::chrono::steady_clock::now();
+}
+
+bool is_started()
+{
+  return internal::_hook_mask.load() & internal::_hook_topology;
+}
+
+void name_thread(const std::string& name)
+{
+  internal::_topology_thread& thread = internal::_local_thread();
+  std::lock_guard<std::mutex> lock(thread.mutex);
+  thread.name = name;
+}
+
+void write_dot(std::ostream& out)
+{
+  const internal::_graph graph(internal::_snapshot());
+
+  out << "digraph topology {\n  rankdir=LR;\n";
+  for (const std::pair<unsigned, std::string>& thread : graph.threads)
+  {
+    out << "  t" << thread.first << " [shape=box,label=";
+    internal::_write_escaped(out, thread.second);
+    out << "];\n";
+  }
+  for (const std::pair<const void* const, unsigned>& channel : graph.channels)
+  {
+    out << "  c" << channel.second << " [shape=ellipse,label=";
+    internal::_write_escaped(out, internal::_channel_label(channel.first));
+    out << "];\n";
+  }
+  for (const auto& thread : graph.edges)
+  {
+    const std::string t("t" + std::to_string(thread.first));
+    for (const std::pair<const void* const, internal::_edge>& edge :
+         thread.second)
+    {
+      const std::string c("c" + std::to_string(graph.channels.at(edge.first)));
+      const internal::_edge& counts = edge.second;
+      if (counts.sent)
+        internal::_write_dot_edge(out, t, c, counts.sent,
+          counts.send_blocked, graph.seconds);
+      if (counts.received)
+        internal::_write_dot_edge(out, c, t, counts.received,
+          counts.recv_blocked, graph.seconds);
+    }
+  }
+  out << "}\n";
+}
+
+void write_json(std::ostream& out)
+{
+  const internal::_graph graph(internal::_snapshot());
+  const char* separator = "";
+
+  out << "{\"seconds\":" << graph.seconds << ",\"threads\":[";
+  for (const std::pair<unsigned, std::string>& thread : graph.threads)
+  {
+    out << separator << "{\"id\":\"t" << thread.first << "\",\"name\":";
+    internal::_write_escaped(out, thread.second);
+    out << '}';
+    separator = ",";
+  }
+
+  separator = "";
+  out << "],\"channels\":[";
+  for (const std::pair<const void* const, unsigned>& channel : graph.channels)
+  {
+    out << separator << "{\"id\":\"c" << channel.second << "\",\"name\":";
+    internal::_write_escaped(out, internal::_channel_label(channel.first));
+    out << '}';
+    separator = ",";
+  }
+
+  separator = "";
+  out << "],\"edges\":[";
+  for (const auto& thread : graph.edges)
+  {
+    const std::string t("t" + std::to_string(thread.first));
+    for (const std::pair<const void* const, internal::_edge>& edge :
+         thread.second)
+    {
+      const std::string c("c" + std::to_string(graph.channels.at(edge.first)));
+      const internal::_edge& counts = edge.second;
+      if (counts.sent)
+      {
+        internal::_write_json_edge(out, separator, t, c, counts.sent,
+          counts.send_blocked, graph.seconds);
+        separator = ",";
+      }
+      if (counts.received)
+      {
+        internal::_write_json_edge(out, separator, c, t, counts.received,
+          counts.recv_blocked, graph.seconds);
+        separator = ",";
+      }
+    }
+  }
+  out << "]}\n";
+}
+
+exporter::exporter(const std::string& path, std::chrono::milliseconds period)
+: m_mutex(),
+  m_stop_cv(),
+  m_stop(false),
+  m_path(path),
+  m_period(period),
+  m_thread(&exporter::run, this) {}
+
+exporter::~exporter()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_stop_cv.notify_one();
+  m_thread.join();
+}
+
+void exporter::write_file()
+{
+  const bool is_dot = m_path.size() >= 4 &&
+    0 == m_path.compare(m_path.size() - 4, 4, ".dot");
+
+  std::ofstream out(m_path);
+  if (is_dot)
+    write_dot(out);
+  else
+    write_json(out);
+}
+
+void exporter::run()
+{
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_stop_cv.wait_for(lock, m_period, [this]{ return m_stop; }))
+        break;
+    }
+    write_file();
+  }
+  write_file();
+}
+
+}
+
+}
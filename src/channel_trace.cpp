@@ -0,0 +1,388 @@
+// Copyright 2014, Alex Horn. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <channel_trace.h>
+
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace cpp
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Time stamp counter if available; otherwise, steady clock nanoseconds
+std::uint64_t _ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+struct _trace_entry
+{
+  std::uint64_t ticks;
+  const void* object;
+  std::uint64_t seq;
+  _event event;
+};
+
+// Entry whose fields can be read while its writer overwrites them
+struct _trace_slot
+{
+  std::atomic<std::uint64_t> ticks;
+  std::atomic<const void*> object;
+  std::atomic<std::uint64_t> seq;
+  std::atomic<_event> event;
+};
+
+// Ring buffer that is written by one thread only. Once full, the
+// oldest entries are overwritten. Readers never block the writer.
+class _trace_buffer
+{
+public:
+  static constexpr std::size_t capacity = 1 << 16;
+
+private:
+  static_assert(0 == (capacity & (capacity - 1)),
+    "capacity must be a power of two");
+
+  const unsigned m_tid;
+  std::atomic<std::uint64_t> m_head;
+  std::atomic<bool> m_is_exited;
+  std::vector<_trace_slot> m_slots;
+
+public:
+  explicit _trace_buffer(unsigned tid)
+  : m_tid(tid),
+    m_head(0),
+    m_is_exited(false),
+    m_slots(capacity) {}
+
+  unsigned tid() const
+  {
+    return m_tid;
+  }
+
+  // Has the thread that owns this buffer exited?
+  bool is_exited() const
+  {
+    return m_is_exited.load(std::memory_order_acquire);
+  }
+
+  void exit()
+  {
+    m_is_exited.store(true, std::memory_order_release);
+  }
+
+  // \pre: calling thread owns this buffer
+  void push(const _trace_entry& entry)
+  {
+    const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+
+    // a reader that sees any of the following stores also sees head,
+    // and thus knows that the entry at head - capacity is overwritten
+    std::atomic_thread_fence(std::memory_order_release);
+
+    _trace_slot& slot = m_slots[head & (capacity - 1)];
+    slot.ticks.store(entry.ticks, std::memory_order_relaxed);
+    slot.object.store(entry.object, std::memory_order_relaxed);
+    slot.seq.store(entry.seq, std::memory_order_relaxed);
+    slot.event.store(entry.event, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
+  }
+
+  // Copies the retained entries in the order they were pushed. Entries
+  // that the writer may have overwritten during the copy are dropped.
+  std::vector<_trace_entry> snapshot() const
+  {
+    const std::uint64_t head = m_head.load(std::memory_order_acquire);
+    const std::uint64_t tail = head < capacity ? 0 : head - capacity;
+
+    std::vector<_trace_entry> entries;
+    entries.reserve(head - tail);
+    for (std::uint64_t i = tail; i < head; i++)
+    {
+      const _trace_slot& slot = m_slots[i & (capacity - 1)];
+      entries.push_back(_trace_entry{
+        slot.ticks.load(std::memory_order_relaxed),
+        slot.object.load(std::memory_order_relaxed),
+        slot.seq.load(std::memory_order_relaxed),
+        slot.event.load(std::memory_order_relaxed)});
+    }
+
+    // the writer may be in the middle of overwriting the entry at
+    // index - capacity for the index that it has yet to publish
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const std::uint64_t index = m_head.load(std::memory_order_relaxed);
+    if (index >= capacity && index - capacity + 1 > tail)
+    {
+      const std::uint64_t n = std::min<std::uint64_t>(head - tail,
+        index - capacity + 1 - tail);
+      entries.erase(entries.begin(), entries.begin() + n);
+    }
+
+    return entries;
+  }
+};
+
+struct _trace_state
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<_trace_buffer>> buffers;
+  unsigned next_tid;
+  std::map<const void*, std::string> names;
+
+  // calibration point of the most recent trace::start()
+  std::uint64_t start_ticks;
+  std::chrono::steady_clock::time_point start_time;
+
+  _trace_state()
+  : mutex(),
+    buffers(),
+    next_tid(1),
+    names(),
+    start_ticks(_ticks()),
+    start_time(std::chrono::steady_clock::now()) {}
+};
+
+_trace_state& _state()
+{
+  static _trace_state state;
+  return state;
+}
+
+// Marks the buffer of the calling thread when the thread exits
+struct _local_trace
+{
+  std::shared_ptr<_trace_buffer> buffer;
+
+  ~_local_trace()
+  {
+    if (buffer)
+      buffer->exit();
+  }
+};
+
+// Registers the calling thread's buffer on its first event, which is
+// recorded only while tracing is started. Buffers outlive their threads
+// so that their events can be written after joining, until the next
+// trace::start() frees them.
+_trace_buffer& _local_buffer()
+{
+  thread_local _local_trace local;
+  if (!local.buffer)
+  {
+    _trace_state& state = _state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    local.buffer = std::make_shared<_trace_buffer>(state.next_tid++);
+    state.buffers.push_back(local.buffer);
+  }
+  return *local.buffer;
+}
+
+const char* _slice_name(_event e)
+{
+  switch (e)
+  {
+  case _event::send_begin:
+  case _event::send_end:
+    return "send";
+  case _event::recv_begin:
+  case _event::recv_end:
+    return "recv";
+  case _event::select_begin:
+  case _event::select_end:
+    return "select";
+  default:
+    return "block";
+  }
+}
+
+}
+
+void _trace_record(_event e, const void* object, std::uint64_t seq)
+{
+  _local_buffer().push(_trace_entry{_ticks(), object, seq, e});
+}
+
+void _write_escaped(std::ostream& out, const std::string& s)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  out << '"';
+  for (const char c : s)
+  {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+std::string _trace_name(const void* channel)
+{
+  _trace_state& state = _state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto iter = state.names.find(channel);
+  return iter == state.names.end() ? std::string() : iter->second;
+}
+
+}
+
+namespace trace
+{
+
+void start()
+{
+  internal::_trace_state& state = internal::_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.start_ticks = internal::_ticks();
+    state.start_time = std::chrono::steady_clock::now();
+
+    // all their events are discarded anyway
+    state.buffers.erase(std::remove_if(state.buffers.begin(),
+      state.buffers.end(),
+      [](const std::shared_ptr<internal::_trace_buffer>& buffer)
+      {
+        return buffer->is_exited();
+      }), state.buffers.end());
+  }
+  internal::_hook_mask.fetch_or(internal::_hook_trace);
+}
+
+void stop()
+{
+  internal::_hook_mask.fetch_and(~internal::_hook_trace);
+}
+
+bool is_started()
+{
+  return internal::_hook_mask.load() & internal::_hook_trace;
+}
+
+void name(const void* channel, const std::string& name)
+{
+  internal::_trace_state& state = internal::_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.names[channel] = name;
+}
+
+void write(std::ostream& out)
+{
+  using internal::_event;
+
+  internal::_trace_state& state = internal::_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  // convert ticks to microseconds, the unit of Chrome's "ts" field
+  const std::uint64_t now_ticks = internal::_ticks();
+  const double elapsed_us = std::chrono::duration<double, std::micro>(
+    std::chrono::steady_clock::now() - state.start_time).count();
+  const double us_per_tick = now_ticks > state.start_ticks ?
+    elapsed_us / (now_ticks - state.start_ticks) : 0.0;
+
+  const auto write_object = [&](const void* object)
+  {
+    auto iter = state.names.find(object);
+    if (iter == state.names.end())
+    {
+      out << '"' << object << '"';
+      return;
+    }
+    internal::_write_escaped(out, iter->second);
+  };
+
+  const char* separator = "\n";
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (const std::shared_ptr<internal::_trace_buffer>& buffer : state.buffers)
+  {
+    const unsigned tid = buffer->tid();
+    out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"tid\":" << tid << ",\"args\":{\"name\":\"thread " << tid << "\"}}";
+    separator = ",\n";
+
+    for (const internal::_trace_entry& entry : buffer->snapshot())
+    {
+      // skip events recorded before the most recent trace::start()
+      if (entry.ticks < state.start_ticks)
+        continue;
+
+      out << separator << "{\"pid\":1,\"tid\":" << tid << ",\"ts\":" <<
+        (entry.ticks - state.start_ticks) * us_per_tick << ',';
+
+      switch (entry.event)
+      {
+      case _event::send_begin:
+      case _event::recv_begin:
+      case _event::select_begin:
+        out << "\"ph\":\"B\",\"cat\":\"channel\",\"name\":\"" <<
+          internal::_slice_name(entry.event) << "\",\"args\":{\"object\":";
+        write_object(entry.object);
+        out << "}}";
+        break;
+      case _event::send_end:
+      case _event::recv_end:
+      case _event::select_end:
+        out << "\"ph\":\"E\"}";
+        break;
+      case _event::send_block:
+      case _event::recv_block:
+        out << "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"channel\","
+          "\"name\":\"block\",\"args\":{\"channel\":";
+        write_object(entry.object);
+        out << "}}";
+        break;
+      case _event::withdraw:
+        // the flow that the enqueue started never ends
+        out << "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"channel\","
+          "\"name\":\"withdraw\",\"args\":{\"channel\":";
+        write_object(entry.object);
+        out << ",\"id\":\"" << entry.object << ':' << entry.seq << "\"}}";
+        break;
+      case _event::enqueue:
+      case _event::dequeue:
+        // flow arrow from sender to receiver of the same element
+        out << (entry.event == _event::enqueue ? "\"ph\":\"s\"" :
+          "\"ph\":\"f\",\"bp\":\"e\"") << ",\"cat\":\"flow\","
+          "\"name\":\"element\",\"id\":\"" << entry.object << ':' <<
+          entry.seq << "\"}";
+        break;
+      }
+    }
+  }
+  out << "\n]}\n";
+}
+
+bool write(const std::string& path)
+{
+  std::ofstream out(path);
+  if (!out)
+    return false;
+
+  write(out);
+  out.close();
+  return !out.fail();
+}
+
+}
+
+}
@@ -0,0 +1,118 @@
+#include <channel>
+#include <channel_adaptive.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+TEST(ChannelAdaptiveTest, SingleProducerSingleConsumer)
+{
+  cpp::adaptive_channel<int, 4> c;
+  EXPECT_EQ(cpp::adaptive_mode::spsc, c.mode());
+
+  // the ring is full after four elements, so the sender blocks
+  std::thread a([c]() mutable
+  {
+    for (int i = 0; i < 1000; i++)
+      c.send(i);
+  });
+  cpp::thread_guard a_guard(a);
+
+  for (int i = 0; i < 1000; i++)
+    EXPECT_EQ(i, c.recv());
+
+  EXPECT_EQ(cpp::adaptive_mode::spsc, c.mode());
+  EXPECT_FALSE(c.is_upgraded());
+}
+
+TEST(ChannelAdaptiveTest, SameThread)
+{
+  cpp::adaptive_channel<std::string, 2> c;
+  c.send("A");
+  c.send(std::string("B"));
+
+  std::string s;
+  c.recv(s);
+  EXPECT_EQ("A", s);
+  EXPECT_EQ("B", *c.recv_ptr());
+  EXPECT_EQ(cpp::adaptive_mode::spsc, c.mode());
+}
+
+TEST(ChannelAdaptiveTest, UpgradeKeepsQueuedElements)
+{
+  cpp::adaptive_channel<int, 8> c;
+  c.send(1);
+  c.send(2);
+
+  // a second sender
+  std::thread a([c]() mutable { c.send(3); });
+  a.join();
+
+  EXPECT_TRUE(c.is_upgraded());
+  EXPECT_EQ(cpp::adaptive_mode::mpsc, c.mode());
+  EXPECT_EQ(1, c.recv());
+  EXPECT_EQ(2, c.recv());
+  EXPECT_EQ(3, c.recv());
+
+  c.send(4);
+  EXPECT_EQ(4, c.recv());
+}
+
+TEST(ChannelAdaptiveTest, UpgradeWakesParkedReceiver)
+{
+  cpp::adaptive_channel<int, 1> c;
+  int i = 0, j = 0;
+
+  // this thread is the sender, and the receiver parks on the empty ring
+  c.send(1);
+  std::thread a([c, &i, &j]() mutable
+  {
+    i = c.recv();
+    j = c.recv();
+  });
+  cpp::thread_guard a_guard(a);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  // a second sender upgrades the channel while this thread still exists
+  std::thread b([c]() mutable { c.send(7); });
+  b.join();
+  a.join();
+
+  EXPECT_EQ(1, i);
+  EXPECT_EQ(7, j);
+  EXPECT_TRUE(c.is_upgraded());
+  EXPECT_EQ(cpp::adaptive_mode::mpsc, c.mode());
+}
+
+TEST(ChannelAdaptiveTest, MultipleProducersMultipleConsumers)
+{
+  cpp::adaptive_channel<unsigned, 16> c;
+  cpp::channel<unsigned long, 4> sums;
+  std::vector<std::thread> threads;
+
+  for (unsigned k = 0; k < 4; k++)
+  {
+    threads.emplace_back([c]() mutable
+    {
+      for (unsigned i = 1; i <= 1000; i++)
+        c.send(i);
+    });
+    threads.emplace_back([c, sums]() mutable
+    {
+      unsigned long sum = 0;
+      for (unsigned i = 0; i < 1000; i++)
+        sum += c.recv();
+      sums.send(sum);
+    });
+  }
+
+  unsigned long sum = 0;
+  for (unsigned k = 0; k < 4; k++)
+    sum += sums.recv();
+
+  for (std::thread& thread : threads)
+    thread.join();
+
+  EXPECT_EQ(4 * 1000 * 1001 / 2UL, sum);
+  EXPECT_EQ(cpp::adaptive_mode::mpmc, c.mode());
+}
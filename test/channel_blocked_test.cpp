@@ -0,0 +1,134 @@
+#include <channel>
+#include <channel_blocked.h>
+#include <sstream>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+// Number of occurrences of s in the current report
+static std::size_t count_blocked(const std::string& s)
+{
+  std::ostringstream out;
+  cpp::blocked::dump(out);
+  const std::string report(out.str());
+
+  std::size_t n = 0;
+  for (std::string::size_type i = report.find(s); i != std::string::npos;
+       i = report.find(s, i + 1))
+    n++;
+  return n;
+}
+
+// Polls the report until s occurs at least n times
+static bool await_blocked(const std::string& s, std::size_t n)
+{
+  for (int i = 0; i < 1000; i++)
+  {
+    if (count_blocked(s) >= n)
+      return true;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return false;
+}
+
+void blocked_receiver(cpp::ichannel<int> c)
+{
+  c.recv();
+}
+
+TEST(BlockedTest, ReceiverIsReported)
+{
+  cpp::channel<int> c;
+  std::thread t(blocked_receiver, c);
+  cpp::thread_guard t_guard(t);
+
+  EXPECT_TRUE(await_blocked("recv on channel", 1));
+  c.send(1);
+}
+
+void blocked_sender(
+  cpp::ichannel<int> prime,
+  cpp::ichannel<int> go,
+  cpp::ochannel<int> out)
+{
+  prime.recv();
+  go.recv();
+  out.send(go.recv());
+}
+
+TEST(BlockedTest, WaitForCycle)
+{
+  cpp::channel<int> a;
+  cpp::channel<int> b;
+  cpp::channel<int> go_x;
+  cpp::channel<int> go_y;
+
+  // Thread x last received on channel b, and is about to send on channel
+  // a, whereas thread y last received on a, and is about to send on b.
+  std::thread x(blocked_sender, b, go_x, a);
+  cpp::thread_guard x_guard(x);
+  std::thread y(blocked_sender, a, go_y, b);
+  cpp::thread_guard y_guard(y);
+
+  b.send(0);
+  a.send(0);
+  go_x.send(0);
+  go_x.send(1);
+  go_y.send(0);
+  go_y.send(2);
+
+  EXPECT_TRUE(await_blocked("send on channel", 2));
+  EXPECT_EQ(1, count_blocked("wait-for cycle"));
+
+  // break the cycle
+  EXPECT_EQ(1, a.recv());
+  EXPECT_EQ(2, b.recv());
+}
+
+TEST(BlockedTest, DumpToFileDescriptor)
+{
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  cpp::blocked::dump(fds[1]);
+  close(fds[1]);
+
+  char buffer[64] = {0};
+  ASSERT_LT(0, read(fds[0], buffer, sizeof(buffer) - 1));
+  close(fds[0]);
+
+  EXPECT_EQ(0, std::string(buffer).find("cpp-channel: "));
+}
+
+TEST(BlockedTest, InstallHandler)
+{
+  cpp::channel<int> c;
+  std::thread t(blocked_receiver, c);
+  cpp::thread_guard t_guard(t);
+  ASSERT_TRUE(await_blocked("recv on channel", 1));
+
+  // the handler writes to stderr, which is redirected into a pipe
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  const int saved_stderr = dup(STDERR_FILENO);
+  ASSERT_LE(0, saved_stderr);
+  ASSERT_LE(0, dup2(fds[1], STDERR_FILENO));
+  close(fds[1]);
+
+  EXPECT_TRUE(cpp::blocked::install_handler(SIGUSR1));
+  EXPECT_EQ(0, raise(SIGUSR1));
+  signal(SIGUSR1, SIG_DFL);
+
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+
+  char buffer[4096] = {0};
+  ASSERT_LT(0, read(fds[0], buffer, sizeof(buffer) - 1));
+  close(fds[0]);
+
+  const std::string report(buffer);
+  EXPECT_EQ(0, report.find("cpp-channel: "));
+  EXPECT_NE(std::string::npos, report.find("recv on channel"));
+  c.send(1);
+}
@@ -0,0 +1,93 @@
+#include <channel>
+#include <channel_parallel.h>
+#include <atomic>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+template<class T, std::size_t N>
+static void send_numbers(cpp::ochannel<T, N> c, T n)
+{
+  for (T i = 1; i <= n; i++)
+    c.send(i);
+}
+
+TEST(ParallelTest, ForEach)
+{
+  cpp::channel<long, 16> c;
+  std::thread producer(send_numbers<long, 16>, c, 10000L);
+  cpp::thread_guard producer_guard(producer);
+
+  std::atomic<long> sum(0);
+  std::atomic<unsigned> calls(0);
+  cpp::parallel_for_each(c, 10000, [&sum, &calls](long i)
+  {
+    sum.fetch_add(i);
+    calls.fetch_add(1);
+  }, 4);
+
+  EXPECT_EQ(10000 * 10001L / 2, sum.load());
+  EXPECT_EQ(10000u, calls.load());
+}
+
+TEST(ParallelTest, Reduce)
+{
+  cpp::channel<long, 8> c;
+  for (unsigned workers : {1u, 3u, 8u})
+  {
+    std::thread producer(send_numbers<long, 8>, c, 1000L);
+    cpp::thread_guard producer_guard(producer);
+
+    // init is combined exactly once
+    EXPECT_EQ(10 + 1000 * 1001L / 2, cpp::parallel_reduce(
+      cpp::ichannel<long, 8>(c), 1000, 10L,
+      [](long a, long b) { return a + b; }, workers));
+  }
+
+  EXPECT_EQ(7L, cpp::parallel_reduce(c, 0, 7L,
+    [](long a, long b) { return a + b; }, 4));
+}
+
+TEST(ParallelTest, ReduceMoreWorkersThanElements)
+{
+  cpp::channel<int, 4> c;
+  send_numbers<int, 4>(c, 3);
+
+  EXPECT_EQ(3, cpp::parallel_reduce(c, 3, 0,
+    [](int a, int b) { return std::max(a, b); }, 16));
+}
+
+TEST(ParallelTest, ForEachPropagatesException)
+{
+  cpp::channel<int, 1000> c;
+  send_numbers<int, 1000>(c, 1000);
+
+  EXPECT_THROW(cpp::parallel_for_each(c, 1000, [](int i)
+  {
+    if (i == 100)
+      throw std::runtime_error("parallel");
+  }, 4), std::runtime_error);
+}
+
+// Has no default constructor
+struct count
+{
+  long n;
+
+  explicit count(long n)
+  : n(n) {}
+};
+
+TEST(ParallelTest, ReduceWithoutDefaultConstructor)
+{
+  cpp::channel<count, 16> c;
+  std::thread producer([c]() mutable
+  {
+    for (long i = 1; i <= 1000; i++)
+      c.send(count(i));
+  });
+  cpp::thread_guard producer_guard(producer);
+
+  EXPECT_EQ(1000 * 1001L / 2, cpp::parallel_reduce(c, 1000, count(0),
+    [](count a, count b) { return count(a.n + b.n); }, 4).n);
+}
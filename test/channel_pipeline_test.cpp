@@ -0,0 +1,132 @@
+#include <channel_pipeline.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+// Source of the numbers 0, 1, ..., n - 1
+static std::function<bool(int&)> numbers(int n)
+{
+  int next = 0;
+  return [next, n](int& i) mutable -> bool
+  {
+    if (next == n)
+      return false;
+
+    i = next++;
+    return true;
+  };
+}
+
+TEST(PipelineTest, FuseCheapStages)
+{
+  std::vector<int> out;
+  const cpp::pipeline p(cpp::make_pipeline<int>("numbers", numbers(0),
+      cpp::cost(10))
+    .map("parse", [](int i) { return i; }, cpp::cost(10000))
+    .filter("even", [](int i) { return i % 2 == 0; }, cpp::cost(10))
+    .map("render", [](int i) { return std::to_string(i); },
+      cpp::cost(10000))
+    .to("out", [](std::string) {}, cpp::cost(10)));
+
+  ASSERT_EQ(2u, p.segments().size());
+  EXPECT_EQ((std::vector<std::string>{"numbers", "parse", "even"}),
+    p.segments()[0].stages);
+  EXPECT_EQ((std::vector<std::string>{"render", "out"}),
+    p.segments()[1].stages);
+  EXPECT_EQ(10020, p.segments()[0].ns);
+  EXPECT_EQ(1u, p.segments()[0].batch);
+  EXPECT_LE(p.segments()[0].batch, p.segments()[0].capacity);
+  EXPECT_EQ(0u, p.segments()[1].capacity);
+
+  // the plan reports the size of the channel that is actually built
+  EXPECT_EQ(16u, p.segments()[0].capacity);
+
+  std::ostringstream plan;
+  p.write(plan);
+  EXPECT_NE(std::string::npos, plan.str().find("-> channel of 16\n"));
+  EXPECT_NE(std::string::npos, plan.str().find(
+    "segment 1: render out (10010 ns, batch 1)\n"));
+}
+
+TEST(PipelineTest, NoFusionWithoutCosts)
+{
+  cpp::pipeline_options options;
+  options.profile["double"] = 5;
+
+  const cpp::pipeline p(cpp::make_pipeline<int>("numbers", numbers(0))
+    .map("double", [](int i) { return 2 * i; })
+    .map("count", [](int i) { return i; }, cpp::stateful(1))
+    .to("out", [](int) {}, cpp::cost(1), options));
+
+  // only the measured cost of "double" is known
+  ASSERT_EQ(3u, p.segments().size());
+  EXPECT_EQ((std::vector<std::string>{"numbers", "double"}),
+    p.segments()[0].stages);
+  EXPECT_EQ(-1, p.segments()[0].ns);
+  EXPECT_EQ(16u, p.segments()[0].batch);
+  EXPECT_EQ((std::vector<std::string>{"count"}), p.segments()[1].stages);
+  EXPECT_EQ(1024u, p.segments()[1].batch);
+  EXPECT_EQ(1024u, p.segments()[0].capacity);
+}
+
+// Never fused, so that every element crosses three channels
+static cpp::pipeline odd_squares(std::vector<std::string>& out)
+{
+  return cpp::make_pipeline<int>("numbers", numbers(10000))
+    .map("square", [](int i) { return static_cast<long>(i) * i; })
+    .filter("odd", [](long i) { return i % 2 == 1; })
+    .map("render", [](long i) { return std::to_string(i); })
+    .to("out", [&out](std::string s) { out.push_back(std::move(s)); });
+}
+
+TEST(PipelineTest, Run)
+{
+  for (unsigned workers : {1u, 3u, 5u})
+  {
+    std::vector<std::string> out;
+    cpp::pipeline p(odd_squares(out));
+    ASSERT_EQ(5u, p.segments().size());
+
+    p.run(workers);
+    ASSERT_EQ(5000u, out.size());
+    for (int i = 0; i < 5000; i++)
+      EXPECT_EQ(std::to_string(static_cast<long>(2 * i + 1) * (2 * i + 1)),
+        out[i]);
+
+    // every stage ran, so every stage was sampled
+    EXPECT_EQ(5u, p.measured().size());
+    EXPECT_LE(0, p.measured().at("square"));
+  }
+}
+
+TEST(PipelineTest, FusedRun)
+{
+  long sum = 0;
+  cpp::pipeline p(cpp::make_pipeline<int>("numbers", numbers(1000),
+      cpp::cost(1))
+    .map("double", [](int i) { return 2 * i; }, cpp::cost(1))
+    .to("sum", [&sum](int i) { sum += i; }, cpp::cost(1)));
+  ASSERT_EQ(1u, p.segments().size());
+
+  p.run();
+  EXPECT_EQ(999 * 1000, sum);
+}
+
+TEST(PipelineTest, RunPropagatesException)
+{
+  int received = 0;
+  cpp::pipeline p(cpp::make_pipeline<int>("numbers", numbers(1000000))
+    .map("check", [](int i) -> int
+    {
+      if (i == 100)
+        throw std::runtime_error("check");
+      return i;
+    })
+    .to("out", [&received](int) { received++; }));
+
+  EXPECT_THROW(p.run(2), std::runtime_error);
+  EXPECT_GE(100, received);
+}
@@ -0,0 +1,172 @@
+#include <channel_placement.h>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include <gtest/gtest.h>
+
+// Copy of /sys/devices/system/cpu for two packages with two cores of
+// two hyper-threads each, numbered like Linux does: CPU t * 4 + p * 2 + c
+// is hyper-thread t of core c of package p. Removed when destroyed.
+class fake_sysfs
+{
+private:
+  std::vector<std::string> m_paths;
+
+  void dir(const std::string& path)
+  {
+    ::mkdir(path.c_str(), 0755);
+    m_paths.push_back(path);
+  }
+
+  void file(const std::string& path, const std::string& contents)
+  {
+    std::ofstream(path) << contents << '\n';
+    m_paths.push_back(path);
+  }
+
+public:
+  const std::string root;
+
+  fake_sysfs()
+  : m_paths(),
+    root("placement_test_cpu")
+  {
+    dir(root);
+    file(root + "/online", "0-7");
+    for (int id = 0; id < 8; id++)
+    {
+      const int p = id / 2 % 2, c = id % 2;
+      const std::string core(std::to_string(p * 2 + c) + ',' +
+        std::to_string(p * 2 + c + 4));
+      const std::string package(std::to_string(p * 2) + '-' +
+        std::to_string(p * 2 + 1) + ',' + std::to_string(p * 2 + 4) + '-' +
+        std::to_string(p * 2 + 5));
+
+      const std::string cpu(root + "/cpu" + std::to_string(id));
+      dir(cpu);
+      dir(cpu + "/topology");
+      file(cpu + "/topology/thread_siblings_list", core);
+      file(cpu + "/topology/physical_package_id", std::to_string(p));
+      dir(cpu + "/cache");
+      dir(cpu + "/cache/index0");
+      file(cpu + "/cache/index0/level", "1");
+      file(cpu + "/cache/index0/shared_cpu_list", core);
+      dir(cpu + "/cache/index1");
+      file(cpu + "/cache/index1/level", "2");
+      file(cpu + "/cache/index1/shared_cpu_list", core);
+      dir(cpu + "/cache/index2");
+      file(cpu + "/cache/index2/level", "3");
+      file(cpu + "/cache/index2/shared_cpu_list", package);
+    }
+  }
+
+  ~fake_sysfs()
+  {
+    for (auto path = m_paths.rbegin(); path != m_paths.rend(); ++path)
+      std::remove(path->c_str());
+  }
+};
+
+TEST(PlacementTest, ReadMachine)
+{
+  fake_sysfs sysfs;
+  const cpp::placement::machine m(sysfs.root);
+  ASSERT_EQ(8u, m.cpus().size());
+
+  const cpp::placement::cpu& c = m.cpus()[7];
+  EXPECT_EQ(7, c.id);
+  EXPECT_EQ(3, c.core);
+  EXPECT_EQ(3, c.l2);
+  EXPECT_EQ(2, c.l3);
+  EXPECT_EQ(1, c.package);
+
+  EXPECT_EQ(cpp::placement::sharing::core,
+    cpp::placement::shared(m.cpus()[1], m.cpus()[5]));
+  EXPECT_EQ(cpp::placement::sharing::l3,
+    cpp::placement::shared(m.cpus()[0], m.cpus()[1]));
+  EXPECT_EQ(cpp::placement::sharing::none,
+    cpp::placement::shared(m.cpus()[0], m.cpus()[2]));
+
+  EXPECT_THROW(cpp::placement::machine("placement_test_missing"),
+    std::runtime_error);
+}
+
+TEST(PlacementTest, CommunicatingStagesShareCaches)
+{
+  fake_sysfs sysfs;
+  const cpp::placement::machine m(sysfs.root);
+
+  // two pipelines of two stages, which barely talk to each other
+  cpp::placement::graph g;
+  const std::size_t a = g.stage("a", 2);
+  const std::size_t x = g.stage("x", 2);
+  const std::size_t b = g.stage("b", 2);
+  const std::size_t y = g.stage("y", 2);
+  g.edge(a, b, 100);
+  g.edge(x, y, 100);
+  g.edge(b, x, 1);
+
+  const cpp::placement::plan p(cpp::placement::place(g, m));
+
+  // every thread gets its own CPU, and cores before hyper-threads
+  std::vector<bool> is_used(8, false);
+  for (std::size_t s : {a, x, b, y})
+  {
+    for (unsigned t = 0; t < 2; t++)
+    {
+      EXPECT_FALSE(is_used[p.at(s, t).id]);
+      is_used[p.at(s, t).id] = true;
+    }
+  }
+  EXPECT_EQ(cpp::placement::sharing::l3,
+    cpp::placement::shared(p.at(a, 0), p.at(a, 1)));
+
+  // each pipeline stays in its package
+  EXPECT_EQ(p.at(a, 0).package, p.at(b, 1).package);
+  EXPECT_EQ(p.at(x, 0).package, p.at(y, 1).package);
+  EXPECT_NE(p.at(a, 0).package, p.at(x, 0).package);
+  EXPECT_THROW(p.at(a, 2), std::out_of_range);
+
+  std::ostringstream out;
+  p.write(out);
+  EXPECT_NE(std::string::npos, out.str().find("a -> b: l3 (weight 100)"));
+  EXPECT_NE(std::string::npos, out.str().find("b -> x: none (weight 1)"));
+}
+
+TEST(PlacementTest, MoreThreadsThanCpus)
+{
+  const cpp::placement::machine m(std::vector<cpp::placement::cpu>{
+    {0, 0, 0, 0, 0}, {1, 1, 1, 0, 0}});
+
+  cpp::placement::graph g;
+  const std::size_t s = g.stage("s", 3);
+  const cpp::placement::plan p(cpp::placement::place(g, m));
+  EXPECT_EQ(0, p.at(s, 0).id);
+  EXPECT_EQ(1, p.at(s, 1).id);
+  EXPECT_EQ(0, p.at(s, 2).id);
+
+  EXPECT_THROW(g.edge(s, 1), std::out_of_range);
+  EXPECT_THROW(cpp::placement::place(g, cpp::placement::machine(
+    std::vector<cpp::placement::cpu>())), std::invalid_argument);
+}
+
+TEST(PlacementTest, Pin)
+{
+  cpp::placement::graph g;
+  const std::size_t s = g.stage("s");
+  const cpp::placement::plan p(cpp::placement::place(g,
+    cpp::placement::machine().allowed()));
+
+  bool is_pinned = false;
+  std::thread t([&p, s, &is_pinned] { is_pinned = p.pin(s, 0); });
+  t.join();
+#ifdef __linux__
+  EXPECT_TRUE(is_pinned);
+#endif
+}
@@ -0,0 +1,98 @@
+#include <channel>
+#include <channel_profile.h>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+constexpr int profile_items = 200;
+
+void profile_source(cpp::ochannel<int> out)
+{
+  cpp::profile::stage_scope scope("source");
+  for (int i = 0; i < profile_items; i++)
+    out.send(i);
+}
+
+// Burns CPU time for every element
+void profile_sink(cpp::ichannel<int> in, volatile unsigned& sum)
+{
+  cpp::profile::stage_scope scope("sink");
+  for (int i = 0; i < profile_items; i++)
+  {
+    const int k = in.recv();
+    for (unsigned j = 0; j < 20000; j++)
+      sum = sum + k * j;
+  }
+}
+
+TEST(ProfileTest, Bottleneck)
+{
+  volatile unsigned sum = 0;
+  cpp::channel<int> c;
+
+  cpp::profile::start();
+  EXPECT_TRUE(cpp::profile::is_started());
+  {
+    std::thread source(profile_source, c);
+    cpp::thread_guard source_guard(source);
+    std::thread sink(profile_sink, c, std::ref(sum));
+    cpp::thread_guard sink_guard(sink);
+  }
+  cpp::profile::stop();
+  EXPECT_FALSE(cpp::profile::is_started());
+
+  const cpp::profile::report r(cpp::profile::summarize());
+  ASSERT_EQ(2, r.stages.size());
+  EXPECT_EQ("sink", r.stages.at(r.bottleneck).name);
+  EXPECT_LE(1.0, r.gain);
+  EXPECT_GE(2.0, r.gain);
+
+  // the source waits for the sink to take its elements
+  const cpp::profile::stage& source = r.stages.at(1 - r.bottleneck);
+  EXPECT_EQ("source", source.name);
+  EXPECT_EQ(1, source.threads);
+  EXPECT_LT(0, source.output_blocked);
+  EXPECT_GE(source.wall, source.busy);
+
+  std::ostringstream out;
+  const std::ios_base::fmtflags flags = out.flags();
+  cpp::profile::write(out);
+  EXPECT_NE(std::string::npos, out.str().find("bottleneck: sink"));
+
+  // the formatting of the caller's stream is left as it was
+  EXPECT_EQ(flags, out.flags());
+  EXPECT_EQ(6, out.precision());
+}
+
+TEST(ProfileTest, ClearedByStart)
+{
+  {
+    cpp::profile::stage_scope scope("cleared");
+  }
+  cpp::profile::start();
+  cpp::profile::stop();
+
+  EXPECT_TRUE(cpp::profile::summarize().stages.empty());
+}
+
+TEST(ProfileTest, CountsOnlyWhileStarted)
+{
+  cpp::profile::stop();
+  {
+    cpp::profile::stage_scope scope("stopped");
+  }
+  {
+    cpp::profile::stage_scope scope("spanning");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    cpp::profile::start();
+  }
+  cpp::profile::stop();
+
+  // the time before start() is left out
+  const cpp::profile::report r(cpp::profile::summarize());
+  ASSERT_EQ(1, r.stages.size());
+  EXPECT_EQ("spanning", r.stages[0].name);
+  EXPECT_EQ(1, r.stages[0].threads);
+  EXPECT_GT(0.1, r.stages[0].wall);
+  EXPECT_GE(r.stages[0].wall, r.stages[0].busy);
+}
@@ -0,0 +1,107 @@
+#include <channel>
+#include <channel_trace.h>
+#include <channel_record.h>
+#include <sstream>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+TEST(RecordTest, RecordAndReplay)
+{
+  cpp::channel<int, 4> c;
+  cpp::trace::name(c, "numbers");
+  cpp::record::capture(c, [](int i) { return std::to_string(i); });
+
+  cpp::record::start();
+  EXPECT_TRUE(cpp::record::is_started());
+  for (int i = 0; i < 3; i++)
+  {
+    c.send(i * 10);
+    EXPECT_EQ(i * 10, c.recv());
+  }
+  cpp::record::stop();
+  EXPECT_FALSE(cpp::record::is_started());
+
+  std::stringstream file;
+  cpp::record::write(file);
+  EXPECT_EQ(0, file.str().find("CPPCHREC"));
+
+  const cpp::record::replayer r(file);
+  const std::size_t id = r.find("numbers");
+  ASSERT_EQ(1, r.channels().size());
+  ASSERT_EQ(0, id);
+  EXPECT_EQ(r.channels().size(), r.find("unknown"));
+
+  ASSERT_EQ(6, r.events().size());
+  for (std::size_t i = 0; i < r.events().size(); i++)
+  {
+    const cpp::record::event& e = r.events()[i];
+    EXPECT_EQ(id, e.channel);
+    if (i % 2 == 0)
+    {
+      EXPECT_EQ(cpp::record::operation::send, e.op);
+      EXPECT_EQ(std::to_string(i * 5), e.payload);
+      EXPECT_EQ(sizeof(int), e.size);
+    }
+    else
+    {
+      EXPECT_EQ(cpp::record::operation::recv, e.op);
+      EXPECT_EQ(sizeof(int), e.size);
+      EXPECT_TRUE(e.payload.empty());
+    }
+
+    if (i > 0)
+    {
+      EXPECT_LE(r.events()[i - 1].time, e.time);
+    }
+  }
+
+  // replays into a different channel as fast as possible
+  cpp::channel<int, 4> d;
+  EXPECT_EQ(3, r.replay(id, d,
+    [](const cpp::record::event& e) { return std::stoi(e.payload); }, 1e9));
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(i * 10, d.recv());
+}
+
+TEST(RecordTest, ClearedByStart)
+{
+  cpp::channel<int, 1> c;
+  c.send(1);
+  c.recv();
+
+  cpp::record::start();
+  cpp::record::stop();
+
+  std::stringstream file;
+  cpp::record::write(file);
+  const cpp::record::replayer r(file);
+  EXPECT_TRUE(r.channels().empty());
+  EXPECT_TRUE(r.events().empty());
+}
+
+TEST(RecordTest, WithdrawnSendIsForgotten)
+{
+  cpp::channel<int> c;
+
+  cpp::record::start();
+  EXPECT_FALSE(c.send_for(1, std::chrono::milliseconds(1)));
+  cpp::record::stop();
+
+  std::stringstream file;
+  cpp::record::write(file);
+  const cpp::record::replayer r(file);
+  EXPECT_TRUE(r.events().empty());
+}
+
+TEST(RecordTest, Malformed)
+{
+  std::istringstream garbage("CPPCHREX");
+  EXPECT_THROW(cpp::record::replayer r(garbage), std::runtime_error);
+
+  std::istringstream truncated(std::string("CPPCHREC\x01\x01", 10));
+  EXPECT_THROW(cpp::record::replayer r(truncated), std::runtime_error);
+
+  EXPECT_THROW(cpp::record::replayer r("no/such/recording"),
+    std::runtime_error);
+}
@@ -0,0 +1,121 @@
+#include <channel>
+#include <channel_shard.h>
+#include <set>
+#include <vector>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+TEST(ShardRuntimeTest, SubmitFromOutside)
+{
+  cpp::shard_runtime runtime(4);
+  EXPECT_EQ(4u, runtime.size());
+  EXPECT_EQ(4u, runtime.current());
+
+  cpp::channel<unsigned, 4> shards;
+  for (unsigned k = 0; k < 4; k++)
+  {
+    EXPECT_GE(runtime.cpu(k), -1);
+    runtime.submit_to(k, [&runtime, shards]() mutable
+    {
+      shards.send(runtime.current());
+    });
+  }
+
+  std::set<unsigned> received;
+  for (unsigned k = 0; k < 4; k++)
+    received.insert(shards.recv());
+
+  EXPECT_EQ((std::set<unsigned>{0, 1, 2, 3}), received);
+  EXPECT_THROW(runtime.submit_to(4, []{}), std::out_of_range);
+}
+
+TEST(ShardRuntimeTest, DefaultShards)
+{
+  cpp::shard_runtime runtime;
+  EXPECT_LE(1u, runtime.size());
+
+  cpp::channel<unsigned, 1> done;
+  runtime.submit_to(runtime.size() - 1, [&runtime, done]() mutable
+  {
+    done.send(runtime.current());
+  });
+  EXPECT_EQ(runtime.size() - 1, done.recv());
+}
+
+// More tasks than a ring holds, so that some of them overflow
+TEST(ShardRuntimeTest, MeshKeepsOrder)
+{
+  cpp::shard_runtime runtime(2, 4, 2);
+  cpp::channel<bool, 1> is_ordered;
+
+  // owned by shard 1
+  std::vector<int> received;
+
+  runtime.submit_to(0, [&runtime, &received, is_ordered]
+  {
+    for (int i = 0; i < 10000; i++)
+      runtime.submit_to(1, [&received, i] { received.push_back(i); });
+
+    runtime.submit_to(1, [&received, is_ordered]() mutable
+    {
+      bool ok = received.size() == 10000;
+      for (std::size_t i = 0; ok && i < received.size(); i++)
+        ok = received[i] == static_cast<int>(i);
+      is_ordered.send(ok);
+    });
+  });
+
+  EXPECT_TRUE(is_ordered.recv());
+}
+
+// hops from shard to shard, and submits to itself on every fourth hop
+static void hop(cpp::shard_runtime& runtime, unsigned n,
+  cpp::channel<unsigned, 1> done)
+{
+  if (n == 0)
+  {
+    done.send(runtime.current());
+    return;
+  }
+
+  const unsigned next = n % 4 == 0 ? runtime.current() :
+    (runtime.current() + 1) % runtime.size();
+  runtime.submit_to(next, [&runtime, n, done] { hop(runtime, n - 1, done); });
+}
+
+TEST(ShardRuntimeTest, HopAcrossShards)
+{
+  cpp::shard_runtime runtime(3);
+  cpp::channel<unsigned, 1> done;
+
+  runtime.submit_to(0, [&runtime, done] { hop(runtime, 1000, done); });
+  EXPECT_EQ(750 % 3u, done.recv());
+}
+
+TEST(ShardRuntimeTest, DestroyWithPendingTasks)
+{
+  std::shared_ptr<int> counted(std::make_shared<int>(0));
+  {
+    cpp::shard_runtime runtime(2, 2);
+    cpp::channel<int> started;
+    cpp::channel<int> release;
+
+    // shard 1 is busy while shard 0 fills its ring
+    runtime.submit_to(1, [started, release]() mutable
+    {
+      started.send(1);
+      release.recv();
+    });
+    started.recv();
+
+    runtime.submit_to(0, [&runtime, counted]
+    {
+      for (int i = 0; i < 8; i++)
+        runtime.submit_to(1, [counted] {});
+    });
+
+    release.send(1);
+  }
+  EXPECT_EQ(1, counted.use_count());
+}
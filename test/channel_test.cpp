@@ -1,6 +1,9 @@
 #include <channel>
+#include <channel_blocked.h>
 #include <functional>
+#include <sstream>
 #include <array>
+#include <stdexcept>
 
 #include <gtest/gtest.h>
 
@@ -727,3 +730,613 @@ TEST(ChannelTest, SelectWaitSleep)
   cpp::select().recv(in, [&i](const char k) { i = k; }).wait(sleepNano);
   EXPECT_EQ('F', i);
 }
+
+TEST(ChannelTest, SelectSendLazy)
+{
+  cpp::channel<std::string> c;
+  cpp::channel<std::string, 1> d;
+  unsigned made = 0;
+  const auto make = [&made]() { made++; return std::string(64, 'A'); };
+
+  // nobody receives on c, and d accepts
+  bool is_sent = false;
+  cpp::select().send_lazy(c, make, [](){ FAIL(); })
+    .send_lazy(d, make, [&is_sent](){ is_sent = true; }).wait();
+  EXPECT_TRUE(is_sent);
+  EXPECT_EQ(1U, made);
+
+  // d is full, so nothing is made
+  EXPECT_FALSE(cpp::select().send_lazy(c, make, [](){})
+    .send_lazy(cpp::ochannel<std::string, 1>(d), make, [](){}).try_once());
+  EXPECT_EQ(1U, made);
+  EXPECT_EQ(std::string(64, 'A'), d.recv());
+
+  // an exception leaves the channel unchanged
+  const auto fail = []() -> std::string { throw std::runtime_error("fail"); };
+  EXPECT_THROW(cpp::select().send_lazy(d, fail, [](){}).try_once(),
+    std::runtime_error);
+  std::string s;
+  EXPECT_FALSE(d.try_recv(s));
+  EXPECT_TRUE(d.try_send("B"));
+  EXPECT_EQ("B", d.recv());
+}
+
+TEST(ChannelTest, TrySendTryRecv)
+{
+  cpp::channel<char, 2> c;
+  char i = '\0';
+
+  EXPECT_FALSE(c.try_recv(i));
+
+  EXPECT_TRUE(c.try_send('A'));
+  EXPECT_TRUE(c.try_send('B'));
+
+  // queue is full
+  EXPECT_FALSE(c.try_send('C'));
+
+  cpp::ichannel<char, 2> in(c);
+  EXPECT_TRUE(in.try_recv(i));
+  EXPECT_EQ('A', i);
+
+  cpp::ochannel<char, 2> out(c);
+  EXPECT_TRUE(out.try_send('C'));
+
+  EXPECT_EQ('B', c.recv());
+  EXPECT_EQ('C', c.recv());
+  EXPECT_FALSE(c.try_recv(i));
+  EXPECT_EQ('A', i);
+}
+
+TEST(ChannelTest, TrySendUnbuffered)
+{
+  cpp::channel<char> c;
+
+  // no receiver is waiting
+  EXPECT_FALSE(c.try_send('A'));
+
+  std::thread a([c]() mutable { EXPECT_EQ('B', c.recv()); });
+  cpp::thread_guard a_guard(a);
+  while (!c.try_send('B'))
+    std::this_thread::yield();
+}
+
+TEST(ChannelTest, SendForRecvForTimeout)
+{
+  const std::chrono::milliseconds timeout(20);
+  cpp::channel<char> c;
+  cpp::channel<char, 1> d;
+  char i = 'X';
+
+  const std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  EXPECT_FALSE(c.recv_for(i, timeout));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, timeout);
+  EXPECT_EQ('X', i);
+
+  // the element is withdrawn and never received
+  EXPECT_FALSE(c.send_for('A', timeout));
+  EXPECT_FALSE(c.try_recv(i));
+
+  EXPECT_TRUE(d.send_for('A', timeout));
+  EXPECT_FALSE(d.send_for('B', timeout));
+  EXPECT_TRUE(d.recv_for(i, timeout));
+  EXPECT_EQ('A', i);
+  EXPECT_FALSE(d.try_recv(i));
+
+  // negative timeouts expire immediately
+  EXPECT_FALSE(d.recv_for(i, std::chrono::seconds(-1)));
+}
+
+// Polls cpp::blocked until s occurs n times in its report
+static void await_blocked(const std::string& s, std::size_t n)
+{
+  for (;;)
+  {
+    std::ostringstream out;
+    cpp::blocked::dump(out);
+    const std::string report(out.str());
+
+    std::size_t k = 0;
+    for (std::string::size_type i = report.find(s); i != std::string::npos;
+         i = report.find(s, i + 1))
+      k++;
+    if (k == n)
+      return;
+
+    std::this_thread::yield();
+  }
+}
+
+TEST(ChannelTest, RecvForTimeoutKeepsWaitingReceiver)
+{
+  cpp::channel<char> c;
+
+  std::thread a([c]() mutable
+  {
+    char i;
+    EXPECT_FALSE(c.recv_for(i, std::chrono::milliseconds(50)));
+  });
+  await_blocked("recv on channel", 1);
+
+  std::thread b([c]() mutable { EXPECT_EQ('A', c.recv()); });
+  cpp::thread_guard b_guard(b);
+  await_blocked("recv on channel", 2);
+  a.join();
+
+  // b still waits, so a nonblocking send eventually succeeds
+  const std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  bool is_sent = false;
+  while (!(is_sent = c.try_send('A')) &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::yield();
+
+  EXPECT_TRUE(is_sent);
+  if (!is_sent)
+    c.send('A');
+}
+
+TEST(ChannelTest, SendForRecvForRendezvous)
+{
+  cpp::channel<char> c;
+  char i = '\0';
+
+  std::thread a([c]() mutable
+  {
+    EXPECT_TRUE(c.send_for('A', std::chrono::hours(1)));
+    c.send('B');
+  });
+  cpp::thread_guard a_guard(a);
+
+  EXPECT_TRUE(c.recv_for(i, std::chrono::hours(1)));
+  EXPECT_EQ('A', i);
+  EXPECT_TRUE(c.recv_for(i, std::chrono::duration<double>::max()));
+  EXPECT_EQ('B', i);
+}
+
+TEST(ChannelTest, TryRecvIf)
+{
+  cpp::channel<int, 8> c;
+  for (int k = 1; k <= 6; k++)
+    c.send(k);
+
+  const auto is_even = [](int k) { return k % 2 == 0; };
+  int i = 0;
+  EXPECT_TRUE(c.try_recv_if(is_even, i));
+  EXPECT_EQ(2, i);
+
+  // only 3 is scanned
+  EXPECT_FALSE(c.try_recv_if(is_even, i, 1));
+  EXPECT_FALSE(c.try_recv_if([](int k) { return k > 6; }, i));
+  EXPECT_EQ(2, i);
+
+  cpp::ichannel<int, 8> in(c);
+  EXPECT_TRUE(in.try_recv_if(is_even, i, 3));
+  EXPECT_EQ(4, i);
+
+  // the others are still in order
+  EXPECT_EQ(1, c.recv());
+  EXPECT_EQ(3, c.recv());
+  EXPECT_EQ(5, c.recv());
+  EXPECT_EQ(6, c.recv());
+}
+
+TEST(ChannelTest, RecvIf)
+{
+  cpp::channel<int, 4> c;
+  cpp::channel<int, 4> acks;
+  int i = 0;
+
+  std::thread a([c, acks]() mutable
+  {
+    for (int k = 1; k <= 3; k++)
+    {
+      c.send(k);
+      acks.recv();
+    }
+    c.send(42);
+  });
+  cpp::thread_guard a_guard(a);
+
+  // recv_if does not swallow the wake-ups of other receivers
+  std::thread b([c, acks]() mutable
+  {
+    for (int k = 1; k <= 3; k++)
+    {
+      EXPECT_EQ(k, c.recv());
+      acks.send(k);
+    }
+  });
+  cpp::thread_guard b_guard(b);
+
+  c.recv_if([](int k) { return k == 42; }, i);
+  EXPECT_EQ(42, i);
+}
+
+TEST(ChannelTest, RecvIfInvisibleToTrySend)
+{
+  cpp::channel<int> c;
+  int i = 0;
+  std::thread a([c, &i]() mutable
+  {
+    c.recv_if([](int) { return true; }, i);
+  });
+  await_blocked("recv on channel", 1);
+
+  // unlike a blocked recv(), recv_if() does not complete the handshake
+  EXPECT_FALSE(c.try_send(7));
+  c.send(7);
+  a.join();
+  EXPECT_EQ(7, i);
+
+  std::thread b([c]() mutable { c.recv(); });
+  await_blocked("recv on channel", 1);
+  EXPECT_TRUE(c.try_send(8));
+  b.join();
+}
+
+TEST(ChannelTest, TrySelectAny)
+{
+  std::vector<cpp::channel<char, 1>> channels(4);
+  char i = '\0';
+
+  EXPECT_EQ(4U, cpp::try_select_any(channels, i));
+  EXPECT_EQ(0U, cpp::try_select_any(std::vector<cpp::channel<char, 1>>(), i));
+
+  channels[2].send('A');
+  EXPECT_EQ(2U, cpp::try_select_any(channels, i));
+  EXPECT_EQ('A', i);
+
+  std::vector<cpp::ichannel<char, 1>> in(channels.begin(), channels.end());
+  channels[3].send('B');
+  EXPECT_EQ(3U, cpp::try_select_any(in, i));
+  EXPECT_EQ('B', i);
+  EXPECT_EQ(4U, cpp::try_select_any(in, i));
+}
+
+TEST(ChannelTest, SelectAny)
+{
+  std::vector<cpp::channel<int>> channels(8);
+  std::vector<std::thread> senders;
+  for (int k = 0; k < 8; k++)
+  {
+    senders.emplace_back([k](cpp::channel<int> c)
+    {
+      for (int j = 0; j < 10; j++)
+        c.send(k);
+    }, channels[k]);
+  }
+
+  std::vector<int> counts(8, 0);
+  int k = -1;
+  for (int j = 0; j < 80; j++)
+  {
+    const std::size_t i = cpp::select_any(channels, k);
+    ASSERT_LT(i, 8U);
+    EXPECT_EQ(static_cast<int>(i), k);
+    counts[i]++;
+  }
+
+  for (std::thread& sender : senders)
+    sender.join();
+
+  for (int count : counts)
+    EXPECT_EQ(10, count);
+}
+
+TEST(ChannelTest, SelectAnyManyReceivers)
+{
+  // more channels than a waiter keeps inline
+  std::vector<cpp::channel<int, 4>> channels(10);
+  std::vector<std::thread> receivers;
+  std::vector<int> sums(4, 0);
+  for (int r = 0; r < 4; r++)
+  {
+    receivers.emplace_back([&channels, &sums, r]()
+    {
+      int k = 0;
+      for (int j = 0; j < 100; j++)
+      {
+        // a lost wakeup fails rather than hangs
+        if (cpp::select_any_for(channels, k, std::chrono::seconds(10)) ==
+            channels.size())
+          return;
+
+        sums[r] += k;
+      }
+    });
+  }
+
+  for (int j = 0; j < 400; j++)
+    channels[j % 10].send(1);
+
+  for (std::thread& receiver : receivers)
+    receiver.join();
+
+  for (int sum : sums)
+    EXPECT_EQ(100, sum);
+}
+
+TEST(ChannelTest, SelectAnyHandsOverElement)
+{
+  for (int trial = 0; trial < 20; trial++)
+  {
+    std::vector<cpp::channel<int, 1>> both(2);
+    const std::vector<cpp::channel<int, 1>> first(1, both[0]);
+
+    // b waits on the first channel only; since it tries once more after
+    // its deadline, a missed element shows as a wait until the deadline
+    std::chrono::steady_clock::duration wait;
+    std::thread b([&first, &wait]()
+    {
+      const auto start = std::chrono::steady_clock::now();
+      int k = 0;
+      cpp::select_any_for(first, k, std::chrono::seconds(2));
+      wait = std::chrono::steady_clock::now() - start;
+    });
+    await_blocked("select ", 1);
+
+    // a parks last, so an element on the first channel notifies a
+    int k = -1;
+    std::size_t i = 2;
+    std::thread a([&both, &k, &i, trial]()
+    {
+      // vary where select_any() starts in case the thread id, which
+      // seeds the random start, is reused
+      for (int j = 0; j < trial; j++)
+        cpp::try_select_any(both, k);
+
+      i = cpp::select_any(both, k);
+    });
+    await_blocked("select ", 2);
+
+    // the tap fills the second channel while the first one is locked,
+    // so a finds both elements; if it takes the one of the second
+    // channel, it must hand over the one of the first channel to b
+    both[0].tap(1.0, both[1]);
+    both[0].send(0);
+    a.join();
+    if (i == 0)
+      both[0].send(0);
+
+    b.join();
+    ASSERT_LT(wait, std::chrono::seconds(1));
+  }
+}
+
+TEST(ChannelTest, SelectAnyFor)
+{
+  std::vector<cpp::channel<char>> channels(3);
+  std::vector<cpp::ichannel<char>> in(channels.begin(), channels.end());
+  char i = 'X';
+
+  EXPECT_EQ(3U, cpp::select_any_for(in, i, std::chrono::milliseconds(20)));
+  EXPECT_EQ('X', i);
+
+  std::thread a([](cpp::channel<char> c) { c.send('A'); }, channels[1]);
+  cpp::thread_guard a_guard(a);
+  EXPECT_EQ(1U, cpp::select_any_for(in, i, std::chrono::hours(1)));
+  EXPECT_EQ('A', i);
+}
+
+// Returns the order in which k receivers, which block one after the
+// other, are woken up by as many sends
+static std::vector<int> wake_order(cpp::wake_policy policy, int k)
+{
+  cpp::channel<int> c;
+  cpp::channel<int, 16> woken;
+  c.set_wake_policy(policy);
+
+  std::vector<std::thread> receivers;
+  for (int i = 0; i < k; i++)
+  {
+    receivers.emplace_back([c, woken, i]() mutable
+    {
+      c.recv();
+      woken.send(i);
+    });
+
+    // receiver i blocks before receiver i + 1 starts
+    await_blocked("recv on channel", i + 1);
+  }
+
+  std::vector<int> order;
+  for (int i = 0; i < k; i++)
+  {
+    c.send(i);
+    order.push_back(woken.recv());
+  }
+
+  for (std::thread& receiver : receivers)
+    receiver.join();
+
+  return order;
+}
+
+TEST(ChannelTest, WakePolicy)
+{
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}),
+    wake_order(cpp::wake_policy::fifo, 4));
+  EXPECT_EQ(std::vector<int>({3, 2, 1, 0}),
+    wake_order(cpp::wake_policy::lifo, 4));
+}
+
+TEST(ChannelTest, WakePolicySenders)
+{
+  cpp::channel<int> c;
+  c.set_wake_policy(cpp::wake_policy::lifo);
+
+  // sender 0 enqueues and waits until its element has been received,
+  // and the others wait to enqueue. Every receive finds a sender that
+  // has yet to finish, so only finishing senders wake the next one.
+  std::vector<std::thread> senders;
+  for (int i = 0; i < 4; i++)
+  {
+    senders.emplace_back([c, i]() mutable { c.send(i); });
+    await_blocked("send on channel", i + 1);
+  }
+
+  EXPECT_EQ(0, c.recv());
+  EXPECT_EQ(3, c.recv());
+  EXPECT_EQ(2, c.recv());
+  EXPECT_EQ(1, c.recv());
+
+  for (std::thread& sender : senders)
+    sender.join();
+}
+
+TEST(ChannelTest, WakePolicyChange)
+{
+  cpp::channel<int> c;
+  cpp::channel<int> d;
+  c.set_wake_policy(cpp::wake_policy::fifo);
+
+  std::thread a([c]() mutable { c.recv(); });
+  std::thread b([d]() mutable { d.recv(); });
+  await_blocked("recv on channel", 2);
+
+  // the receivers blocked under the other policy still wake up
+  c.set_wake_policy(cpp::wake_policy::any);
+  d.set_wake_policy(cpp::wake_policy::lifo);
+  c.send(1);
+  d.send(2);
+
+  a.join();
+  b.join();
+}
+
+TEST(ChannelTest, WakePolicyChangeKeepsServingBlockedThread)
+{
+  cpp::channel<int> c;
+  cpp::channel<int, 16> woken;
+
+  std::vector<std::thread> receivers;
+  auto start_receiver = [&receivers, &c, &woken](int i)
+  {
+    receivers.emplace_back([c, woken, i]() mutable
+    {
+      c.recv();
+      woken.send(i);
+    });
+  };
+
+  // receiver 0 blocks under wake_policy::any
+  start_receiver(0);
+  await_blocked("recv on channel", 1);
+  c.set_wake_policy(cpp::wake_policy::fifo);
+
+  // another receiver always waits under the new policy, yet receiver 0,
+  // which blocked first, is woken after a few sends
+  int sends = 0;
+  bool is_woken = false;
+  while (!is_woken && sends < 10)
+  {
+    start_receiver(sends + 1);
+    await_blocked("recv on channel", 2);
+    c.send(sends++);
+    is_woken = woken.recv() == 0;
+  }
+  EXPECT_TRUE(is_woken);
+
+  // release the receivers that are still blocked
+  for (std::size_t i = sends; i < receivers.size(); i++)
+    c.send(0);
+
+  for (std::thread& receiver : receivers)
+    receiver.join();
+}
+
+TEST(ChannelTest, Tap)
+{
+  cpp::channel<int, 16> c;
+  cpp::channel<int, 4> debug;
+
+  // every other element, and drop once debug is full
+  c.tap(0.5, debug);
+  for (int i = 0; i < 12; i++)
+    c.send(i);
+
+  for (int i = 0; i < 12; i++)
+    EXPECT_EQ(i, c.recv());
+
+  EXPECT_EQ(1, debug.recv());
+  EXPECT_EQ(3, debug.recv());
+  EXPECT_EQ(5, debug.recv());
+  EXPECT_EQ(7, debug.recv());
+
+  // nothing is mirrored after untap()
+  c.untap();
+  c.send(12);
+  EXPECT_EQ(12, c.recv());
+  c.send(13);
+  EXPECT_EQ(13, c.recv());
+
+  c.tap(1.0, debug);
+  c.send(14);
+  EXPECT_EQ(14, c.recv());
+  EXPECT_EQ(14, debug.recv());
+}
+
+void send_numbers(cpp::ochannel<int, 1> c)
+{
+  cpp::select().send_only(c, 42).wait();
+}
+
+void send_numbers_to(cpp::ochannel<int> c)
+{
+  c.send(42);
+}
+
+TEST(ChannelTest, TapWithProjection)
+{
+  cpp::channel<int, 1> c;
+  cpp::channel<std::string, 1> debug;
+
+  c.tap(1.0, debug, [](const int k) { return std::to_string(k); });
+
+  std::thread t(send_numbers, cpp::ochannel<int, 1>(c));
+  cpp::thread_guard t_guard(t);
+  EXPECT_EQ(42, c.recv());
+  EXPECT_EQ("42", debug.recv());
+}
+
+TEST(ChannelTest, TapIntoSelect)
+{
+  cpp::channel<int, 1> c;
+  cpp::channel<int> debug;
+  c.tap(1.0, debug);
+
+  // dropped, since nobody receives from debug
+  c.send(7);
+  EXPECT_EQ(7, c.recv());
+
+  // the tap's send must not look like one side of a select
+  int k = 0;
+  EXPECT_FALSE(cpp::select().recv_only(debug, k).try_once());
+
+  std::thread t(send_numbers_to, cpp::ochannel<int>(debug));
+  cpp::thread_guard t_guard(t);
+  EXPECT_EQ(42, debug.recv());
+}
+
+TEST(ChannelTest, TapProjectionThrows)
+{
+  cpp::channel<int, 1> c;
+  cpp::channel<int, 1> debug;
+
+  c.tap(1.0, debug, [](const int k) -> int
+  {
+    if (k == 1)
+      throw std::runtime_error("projection");
+    return k;
+  });
+
+  int k = 0;
+  EXPECT_THROW(c.send(1), std::runtime_error);
+  EXPECT_FALSE(c.try_recv(k));
+
+  // the channel is not wedged
+  c.send(2);
+  EXPECT_EQ(2, c.recv());
+  EXPECT_EQ(2, debug.recv());
+}
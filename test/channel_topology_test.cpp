@@ -0,0 +1,88 @@
+#include <channel>
+#include <channel_trace.h>
+#include <channel_topology.h>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+
+#include <gtest/gtest.h>
+
+template<int N>
+void topology_producer(cpp::ochannel<int> c)
+{
+  cpp::topology::name_thread("producer");
+  for (int i = 0; i < N; i++)
+    c.send(i);
+}
+
+TEST(TopologyTest, Pipeline)
+{
+  cpp::channel<int> c;
+  cpp::trace::name(c, "numbers");
+
+  cpp::topology::start();
+  EXPECT_TRUE(cpp::topology::is_started());
+  {
+    std::thread t(topology_producer<100>, c);
+    cpp::thread_guard t_guard(t);
+    for (int i = 0; i < 100; i++)
+      EXPECT_EQ(i, c.recv());
+  }
+  cpp::topology::stop();
+  EXPECT_FALSE(cpp::topology::is_started());
+
+  std::ostringstream dot;
+  cpp::topology::write_dot(dot);
+  EXPECT_EQ(0, dot.str().find("digraph topology {"));
+  EXPECT_NE(std::string::npos, dot.str().find("label=\"numbers\""));
+  EXPECT_NE(std::string::npos, dot.str().find("label=\"producer\""));
+  EXPECT_NE(std::string::npos, dot.str().find(" msg/s"));
+
+  std::ostringstream json;
+  cpp::topology::write_json(json);
+  EXPECT_NE(std::string::npos, json.str().find("\"name\":\"numbers\""));
+
+  // one edge into the channel and one edge out of it
+  const std::string::size_type first = json.str().find("\"messages\":100,");
+  ASSERT_NE(std::string::npos, first);
+  EXPECT_NE(std::string::npos, json.str().find("\"messages\":100,", first + 1));
+}
+
+TEST(TopologyTest, Sampling)
+{
+  cpp::channel<int, 1> c;
+
+  // the thread alternates between sends and receives, so an odd
+  // period samples both equally often
+  cpp::topology::start(5);
+  for (int i = 0; i < 100; i++)
+  {
+    c.send(i);
+    c.recv();
+  }
+  cpp::topology::stop();
+
+  // every fifth operation counts five times
+  std::ostringstream json;
+  cpp::topology::write_json(json);
+  EXPECT_NE(std::string::npos, json.str().find("\"messages\":100,"));
+}
+
+TEST(TopologyTest, Exporter)
+{
+  const std::string path("topology_test.dot");
+  cpp::topology::start();
+  {
+    cpp::topology::exporter exporter(path, std::chrono::milliseconds(1));
+    cpp::channel<int, 1> c;
+    c.send(1);
+    c.recv();
+  }
+  cpp::topology::stop();
+
+  std::ifstream in(path);
+  std::string line;
+  ASSERT_TRUE(static_cast<bool>(std::getline(in, line)));
+  EXPECT_EQ("digraph topology {", line);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,147 @@
+#include <channel>
+#include <channel_trace.h>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+void trace_sender(cpp::ochannel<int> c)
+{
+  c.send(42);
+}
+
+TEST(TraceTest, FlowFromSenderToReceiver)
+{
+  cpp::channel<int> c;
+  cpp::trace::name(c, "answer");
+
+  cpp::trace::start();
+  EXPECT_TRUE(cpp::trace::is_started());
+  {
+    std::thread t(trace_sender, c);
+    cpp::thread_guard t_guard(t);
+    EXPECT_EQ(42, c.recv());
+  }
+  cpp::trace::stop();
+  EXPECT_FALSE(cpp::trace::is_started());
+
+  std::ostringstream out;
+  cpp::trace::write(out);
+  const std::string json(out.str());
+
+  EXPECT_NE(std::string::npos, json.find("\"traceEvents\""));
+  EXPECT_NE(std::string::npos, json.find("\"answer\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"send\""));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"recv\""));
+
+  // flow start and end must share the same id
+  const std::string::size_type s = json.find("\"ph\":\"s\"");
+  ASSERT_NE(std::string::npos, s);
+  const std::string::size_type id = json.find("\"id\":", s);
+  const std::string flow_id = json.substr(id, json.find('}', id) - id);
+  const std::string::size_type f = json.find("\"ph\":\"f\"");
+  ASSERT_NE(std::string::npos, f);
+  EXPECT_NE(std::string::npos, json.find(flow_id, f));
+}
+
+TEST(TraceTest, SelectSlice)
+{
+  cpp::channel<char, 1> c;
+  char k = '\0';
+
+  cpp::trace::start();
+  c.send('A');
+  cpp::select().recv_only(c, k).wait();
+  cpp::trace::stop();
+  EXPECT_EQ('A', k);
+
+  std::ostringstream out;
+  cpp::trace::write(out);
+  EXPECT_NE(std::string::npos, out.str().find("\"name\":\"select\""));
+}
+
+TEST(TraceTest, NothingRecordedWhenStopped)
+{
+  cpp::channel<int, 1> c;
+  cpp::trace::name(c, "quiet");
+
+  // discards all earlier events
+  cpp::trace::start();
+  cpp::trace::stop();
+
+  c.send(7);
+  EXPECT_EQ(7, c.recv());
+
+  std::ostringstream out;
+  cpp::trace::write(out);
+  EXPECT_EQ(std::string::npos, out.str().find("\"quiet\""));
+  EXPECT_EQ(std::string::npos, out.str().find("\"ph\":\"B\""));
+}
+
+static std::size_t count_threads()
+{
+  std::ostringstream out;
+  cpp::trace::write(out);
+
+  const std::string json(out.str());
+  std::size_t n = 0;
+  for (std::string::size_type i = json.find("\"thread_name\"");
+       i != std::string::npos; i = json.find("\"thread_name\"", i + 1))
+    n++;
+  return n;
+}
+
+TEST(TraceTest, StartFreesBuffersOfExitedThreads)
+{
+  cpp::channel<int> c;
+
+  cpp::trace::start();
+  {
+    std::thread t(trace_sender, c);
+    cpp::thread_guard t_guard(t);
+    EXPECT_EQ(42, c.recv());
+  }
+  cpp::trace::stop();
+
+  // the joined thread's events can still be written
+  const std::size_t n = count_threads();
+  ASSERT_LE(1u, n);
+
+  cpp::trace::start();
+  cpp::trace::stop();
+  EXPECT_GT(n, count_threads());
+}
+
+TEST(TraceTest, WithdrawnSendKeepsFlowIdsUnique)
+{
+  cpp::channel<int> c;
+
+  cpp::trace::start();
+  EXPECT_FALSE(c.send_for(1, std::chrono::milliseconds(1)));
+  {
+    std::thread t(trace_sender, c);
+    cpp::thread_guard t_guard(t);
+    EXPECT_EQ(42, c.recv());
+  }
+  cpp::trace::stop();
+
+  std::ostringstream out;
+  cpp::trace::write(out);
+  const std::string json(out.str());
+
+  // the withdrawn element's flow never ends, and the received element's
+  // flow has an id of its own
+  const std::string::size_type w = json.find("\"name\":\"withdraw\"");
+  ASSERT_NE(std::string::npos, w);
+  const std::string::size_type id = json.find("\"id\":", w);
+  const std::string withdrawn_id = json.substr(id, json.find('}', id) - id);
+
+  const std::string::size_type f = json.find("\"ph\":\"f\"");
+  ASSERT_NE(std::string::npos, f);
+  const std::string::size_type received = json.find("\"id\":", f);
+  const std::string received_id = json.substr(received,
+    json.find('}', received) - received);
+
+  EXPECT_NE(withdrawn_id, received_id);
+  EXPECT_EQ(std::string::npos, json.find("\"ph\":\"f\"", f + 1));
+  EXPECT_NE(json.find(received_id), json.rfind(received_id));
+}